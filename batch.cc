@@ -0,0 +1,188 @@
+#include "libgfm.h"
+#include "numa.hh"
+#include "pool.hh"
+#include "stats.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+void attest(bool test, const char * epilogue, ...);
+gfm_codec * MakeCodec(const uint8_t numData, const uint8_t numParity,
+                      const uint8_t numGroups);
+bool CreateParity(const gfm_codec * codec, int in, const std::string & stub);
+
+extern size_t      memLimit;
+extern unsigned    lrcGroups;
+extern Semaphore * ioLimit;
+extern int         numaNode;
+
+// one line of the manifest
+struct BatchJob
+{
+    std::string input;
+    std::string stub;
+    unsigned    numData;
+    unsigned    numParity;
+    const gfm_codec * codec;
+};
+
+// "INPUT STUB NUM_DATA NUM_PARITY" per line, '#' to the end of a
+// line is a comment
+static std::vector<BatchJob> ReadManifest(const char * manifest)
+{
+    FILE * file = strcmp(manifest, "-") ? fopen(manifest, "r") : stdin;
+    attest(file, "Unable to open manifest '%s': %m", manifest);
+
+    std::vector<BatchJob> jobs;
+    char line[4096];
+    for (unsigned lineNum = 1; fgets(line, sizeof(line), file); lineNum++)
+    {
+        char * hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+
+        char input[2048];
+        char stub[2048];
+        int  numData   = 0;
+        int  numParity = 0;
+        char extra;
+        int n = sscanf(line, "%2047s %2047s %d %d %c",
+                       input, stub, &numData, &numParity, &extra);
+        if (n <= 0)
+        {
+            // blank
+            continue;
+        }
+        attest(n == 4, "%s:%u: expected INPUT STUB NUM_DATA NUM_PARITY",
+               manifest, lineNum);
+        attest((numData > 0) && (numData < 250),
+               "%s:%u: between 1 and 249 data files", manifest, lineNum);
+        attest((numParity > 0) && (numParity < 250),
+               "%s:%u: between 1 and 249 parity files", manifest, lineNum);
+        attest((numData + numParity) <= 250,
+               "%s:%u: data + parity must not exceed 250", manifest, lineNum);
+        attest(((int)lrcGroups <= numData) &&
+               ((numData + numParity + lrcGroups) <= 250),
+               "%s:%u: too many --lrc groups", manifest, lineNum);
+
+        BatchJob job = {input, stub, (unsigned)numData, (unsigned)numParity, 0};
+        jobs.push_back(job);
+    }
+    if (file != stdin)
+    {
+        fclose(file);
+    }
+    return jobs;
+}
+
+// gfm --batch MANIFEST: encode every file in it, 'numJobs' at a time
+// with at most 'numIo' reads and writes in progress (0 for no limit).
+// One codec per geometry, shared by all the files that use it.
+// A file that can't be read, or whose shards can't be created, is
+// reported and the rest carry on. Returns the exit status, not 0 if
+// any were.
+int Batch(const char * manifest, unsigned numJobs, unsigned numIo)
+{
+    std::vector<BatchJob> jobs = ReadManifest(manifest);
+
+    std::map<std::pair<unsigned, unsigned>, gfm_codec *> codecs;
+    uint64_t total = 0;
+    for (size_t idx = 0; idx < jobs.size(); idx++)
+    {
+        BatchJob & job = jobs[idx];
+        gfm_codec *& codec = codecs[std::make_pair(job.numData, job.numParity)];
+        if (!codec)
+        {
+            codec = MakeCodec(job.numData, job.numParity, lrcGroups);
+        }
+        job.codec = codec;
+
+        struct stat st;
+        if (!stat(job.input.c_str(), &st) && S_ISREG(st.st_mode))
+        {
+            total += st.st_size;
+        }
+    }
+    stats.Expect(total);
+
+    if (!numJobs)
+    {
+        numJobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+    numJobs = std::max<size_t>(1, std::min<size_t>(numJobs, jobs.size()));
+    // --mem-limit is for all of them together
+    memLimit /= numJobs;
+    Semaphore io(numIo);
+    if (numIo)
+    {
+        ioLimit = &io;
+    }
+
+    // each worker takes the next file until there are none left.
+    // --numa: the workers are dealt out over the nodes (or all put on
+    // the one given), a file's stripes and coding on its worker's node
+    std::atomic<size_t> next(0);
+    std::atomic<unsigned> failed(0);
+    std::vector<std::thread> workers;
+    for (unsigned w = 0; w < numJobs; w++)
+    {
+        workers.push_back(std::thread([&, w]()
+        {
+            if (numaNode != NUMA_ANY)
+            {
+                Numa::runOn((numaNode == NUMA_AUTO)
+                            ? (int)(w % Numa::nodes())
+                            : numaNode);
+            }
+            for (size_t idx = next++; idx < jobs.size(); idx = next++)
+            {
+                const BatchJob & job = jobs[idx];
+                int in = open(job.input.c_str(), O_RDONLY);
+                struct stat st;
+                if ((in < 0) || fstat(in, &st) || S_ISDIR(st.st_mode))
+                {
+                    fprintf(stderr, "%s: unable to read '%s': %s\n",
+                            job.stub.c_str(), job.input.c_str(),
+                            (in < 0) ? strerror(errno) : "a directory");
+                    if (in >= 0) close(in);
+                    failed++;
+                    continue;
+                }
+                // CreateParity() closes it
+                if (!CreateParity(job.codec, in, job.stub))
+                {
+                    fprintf(stderr, "%s: not encoded\n", job.stub.c_str());
+                    failed++;
+                }
+            }
+        }));
+    }
+    for (size_t w = 0; w < workers.size(); w++)
+    {
+        workers[w].join();
+    }
+    ioLimit = 0;
+
+    for (auto & c : codecs)
+    {
+        gfm_codec_destroy(c.second);
+    }
+    if (failed)
+    {
+        fprintf(stderr, "%u of %zu files not encoded\n",
+                (unsigned)failed, jobs.size());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,429 @@
+#include "gfm.hh"
+#include "libgfm.h"
+#include "numa.hh"
+#include "pool.hh"
+#include "timer.hh"
+
+#include <limits.h>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+void attest(bool test, const char * epilogue, ...);
+extern bool hugePages;
+
+// "max" in an erasure list, i.e. numParity
+const unsigned MAX_ERASURES = UINT_MAX;
+
+// --numa=: where the threads and their stripes are. 'off' leaves it
+// to the kernel, 'local' deals the threads out over the nodes with
+// each one's stripes on its own node, 'remote' the same but with
+// them on the next node over, i.e. what not bothering risks.
+enum Placement { PLACE_OFF, PLACE_LOCAL, PLACE_REMOTE };
+static const char * const PLACEMENTS[] = {"off", "local", "remote"};
+
+// "4,10,max" -> {4, 10, MAX_ERASURES}
+static std::vector<unsigned> ParseList(const char * arg)
+{
+    std::vector<unsigned> ret;
+    while (*arg)
+    {
+        if (!strncmp(arg, "max", 3))
+        {
+            ret.push_back(MAX_ERASURES);
+            arg += 3;
+        }
+        else
+        {
+            char * endptr = 0;
+            ret.push_back(strtoul(arg, &endptr, 0));
+            attest(endptr != arg, "bad number in list: '%s'", arg);
+            arg = endptr;
+        }
+        if (*arg == ',')
+        {
+            arg++;
+        }
+    }
+    return ret;
+}
+
+// split the stripes among the threads, round robin. 'pin' puts
+// thread t on node t % nodes.
+template <typename F>
+static void RunThreads(unsigned threads, size_t numStripes, bool pin, F fn)
+{
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; t++)
+    {
+        pool.push_back(std::thread([=]()
+        {
+            if (pin)
+            {
+                Numa::runOn(t % Numa::nodes());
+            }
+            for (size_t s = t; s < numStripes; s += threads)
+            {
+                fn(s);
+            }
+        }));
+    }
+    for (size_t t = 0; t < pool.size(); t++)
+    {
+        pool[t].join();
+    }
+}
+
+struct BenchResult
+{
+    unsigned numData;
+    unsigned numParity;
+    size_t   blockSize;
+    unsigned erasures;
+    const char * kernel;
+    unsigned threads;
+    Placement numa;
+    // bytes of data (not parity) per pass
+    uint64_t bytes;
+    uint64_t encodeNs;
+    uint64_t encodeCycles;
+    uint64_t decodeNs;
+    uint64_t decodeCycles;
+    // per decoder, i.e. per gfm_decoder_create()
+    uint64_t recoveryNs;
+};
+
+static void Print(const BenchResult & r, bool json, bool first)
+{
+    // bytes per ns == GB/s
+    double encGBps = (double)r.bytes / r.encodeNs;
+    double decGBps = r.decodeNs ? (double)r.bytes / r.decodeNs : 0;
+    double encCpb  = (double)r.encodeCycles / r.bytes;
+    double decCpb  = (double)r.decodeCycles / r.bytes;
+
+    if (json)
+    {
+        printf("%s\n  {\"numData\": %u, \"numParity\": %u, \"blockSize\": %zu,"
+               " \"erasures\": %u, \"kernel\": \"%s\", \"threads\": %u,"
+               " \"encodeGBps\": %.3f, \"encodeCpb\": %.3f,"
+               " \"decodeGBps\": %.3f, \"decodeCpb\": %.3f,"
+               " \"recoveryUs\": %.3f, \"numa\": \"%s\"}",
+               first ? "[" : ",",
+               r.numData, r.numParity, r.blockSize,
+               r.erasures, r.kernel, r.threads,
+               encGBps, encCpb, decGBps, decCpb,
+               r.recoveryNs / 1000.0, PLACEMENTS[r.numa]);
+        return;
+    }
+    if (first)
+    {
+        printf("numData,numParity,blockSize,erasures,kernel,threads,"
+               "encodeGBps,encodeCpb,decodeGBps,decodeCpb,recoveryUs,numa\n");
+    }
+    printf("%u,%u,%zu,%u,%s,%u,%.3f,%.3f,%.3f,%.3f,%.3f,%s\n",
+           r.numData, r.numParity, r.blockSize,
+           r.erasures, r.kernel, r.threads,
+           encGBps, encCpb, decGBps, decCpb,
+           r.recoveryNs / 1000.0, PLACEMENTS[r.numa]);
+}
+
+// encode and decode 'size' bytes of data in memory, no I/O at all.
+// Built on the GFM::BIT() junk so the decode can be checked.
+static BenchResult Run(gfm_codec * codec,
+                       std::vector<uint8_t **> & stripes,
+                       size_t blockSize,
+                       unsigned erasures,
+                       unsigned threads,
+                       Placement numa)
+{
+    const unsigned numData   = gfm_codec_data(codec);
+    const unsigned numParity = gfm_codec_parity(codec);
+    const size_t numStripes  = stripes.size();
+
+    BenchResult r;
+    memset(&r, 0, sizeof(r));
+    r.numData   = numData;
+    r.numParity = numParity;
+    r.blockSize = blockSize;
+    r.erasures  = erasures;
+    r.kernel    = gfm_codec_kernel(codec);
+    r.threads   = threads;
+    r.numa      = numa;
+    r.bytes     = numStripes * numData * blockSize;
+
+    for (size_t s = 0; s < numStripes; s++)
+    {
+        GFM::fill(stripes[s], numData, blockSize);
+    }
+
+    uint64_t t0 = now();
+    uint64_t c0 = cycles();
+    RunThreads(threads, numStripes, numa != PLACE_OFF, [&](size_t s)
+    {
+        gfm_encode(codec, stripes[s], blockSize);
+    });
+    r.encodeCycles = cycles() - c0;
+    r.encodeNs     = now() - t0;
+
+    if (!erasures)
+    {
+        return r;
+    }
+
+    // lose the data shards first, they're the ones that need rebuilding
+    uint8_t erased[GFM_MAX_SHARDS] = {0,};
+    for (unsigned idx = 0; idx < erasures; idx++)
+    {
+        erased[idx] = 1;
+    }
+    for (size_t s = 0; s < numStripes; s++)
+    {
+        for (unsigned idx = 0; (idx < erasures) && (idx < numData); idx++)
+        {
+            memset(stripes[s][idx], 0, blockSize);
+        }
+    }
+
+    // building the recovery matrix is quick, so average a few
+    const unsigned reps = 16;
+    gfm_decoder * decoder = 0;
+    t0 = now();
+    for (unsigned rep = 0; rep < reps; rep++)
+    {
+        gfm_decoder_destroy(decoder);
+        int rc = gfm_decoder_create(codec, erased, &decoder);
+        attest(rc == GFM_OK, "Unable to create decoder: %s",
+               gfm_strerror(rc));
+    }
+    r.recoveryNs = (now() - t0) / reps;
+
+    t0 = now();
+    c0 = cycles();
+    RunThreads(threads, numStripes, numa != PLACE_OFF, [&](size_t s)
+    {
+        gfm_decode(decoder, stripes[s], blockSize);
+    });
+    r.decodeCycles = cycles() - c0;
+    r.decodeNs     = now() - t0;
+
+    gfm_decoder_destroy(decoder);
+
+    for (size_t s = 0; s < numStripes; s++)
+    {
+        attest(GFM::check(stripes[s], numData, blockSize),
+               "%s: decode mismatch (%u + %u, %u erasures)",
+               r.kernel, numData, numParity, erasures);
+    }
+    return r;
+}
+
+static void BenchUsage(const char * prog)
+{
+    fprintf(stderr,
+            "%s --bench [--json] [--size=MiB] [--data=LIST] [--parity=LIST]\n"
+            "\t[--block=LIST] [--erasures=LIST] [--kernel=LIST] [--threads=LIST]\n"
+            "\t[--numa=LIST]\n"
+            "\tLIST is comma separated, erasures may include 'max'.\n"
+            "\tnuma: off (default), local or remote stripes, %d node(s)\n"
+            "\tkernels:",
+            prog, Numa::nodes());
+    for (unsigned idx = 0; gfm_kernel(idx); idx++)
+    {
+        fprintf(stderr, " %s", gfm_kernel(idx));
+    }
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+/**
+   gfm --bench ...
+   In-memory encode/decode throughput across a matrix of
+   geometries, block sizes, erasure counts, kernels, threads and
+   NUMA placements.
+   One CSV (or JSON) record per combination on stdout.
+*/
+int Bench(int argc, char ** argv)
+{
+    bool json = false;
+    size_t size = 32 << 20;
+    std::vector<unsigned> data(1, 4);
+    data.push_back(10);
+    std::vector<unsigned> parity(1, 2);
+    parity.push_back(4);
+    std::vector<unsigned> block(1, 4096);
+    block.push_back(64 * 1024);
+    std::vector<unsigned> erasures(1, 1);
+    erasures.push_back(MAX_ERASURES);
+    std::vector<std::string> kernels;
+    for (unsigned idx = 0; gfm_kernel(idx); idx++)
+    {
+        kernels.push_back(gfm_kernel(idx));
+    }
+    std::vector<unsigned> threads(1, 1);
+    if (std::thread::hardware_concurrency() > 1)
+    {
+        threads.push_back(std::thread::hardware_concurrency());
+    }
+    std::vector<Placement> numa(1, PLACE_OFF);
+
+    for (int idx = 1; idx < argc; idx++)
+    {
+        const char * arg = argv[idx];
+        const char * val = strchr(arg, '=');
+        val = val ? val + 1 : "";
+
+        if      (!strcmp(arg, "--json"))          json = true;
+        else if (!strcmp(arg, "--csv"))           json = false;
+        else if (!strncmp(arg, "--size=", 7))     size = strtoul(val, 0, 0) << 20;
+        else if (!strncmp(arg, "--data=", 7))     data = ParseList(val);
+        else if (!strncmp(arg, "--parity=", 9))   parity = ParseList(val);
+        else if (!strncmp(arg, "--block=", 8))    block = ParseList(val);
+        else if (!strncmp(arg, "--erasures=", 11)) erasures = ParseList(val);
+        else if (!strncmp(arg, "--threads=", 10)) threads = ParseList(val);
+        else if (!strncmp(arg, "--numa=", 7))
+        {
+            numa.clear();
+            std::string list(val);
+            size_t pos = 0;
+            while (pos <= list.size())
+            {
+                size_t end = list.find(',', pos);
+                if (end == std::string::npos) end = list.size();
+                const std::string name = list.substr(pos, end - pos);
+                unsigned p = 0;
+                while ((p < 3) && (name != PLACEMENTS[p])) p++;
+                attest(p < 3, "--numa is off, local or remote, not '%s'",
+                       name.c_str());
+                numa.push_back((Placement)p);
+                pos = end + 1;
+            }
+        }
+        else if (!strncmp(arg, "--kernel=", 9))
+        {
+            kernels.clear();
+            std::string list(val);
+            size_t pos = 0;
+            while (pos <= list.size())
+            {
+                size_t end = list.find(',', pos);
+                if (end == std::string::npos) end = list.size();
+                kernels.push_back(list.substr(pos, end - pos));
+                pos = end + 1;
+            }
+        }
+        else BenchUsage(argv[0]);
+    }
+
+    bool first = true;
+    for (size_t di = 0; di < data.size(); di++)
+    for (size_t pi = 0; pi < parity.size(); pi++)
+    {
+        const unsigned numData   = data[di];
+        const unsigned numParity = parity[pi];
+        gfm_codec * codec = 0;
+        int rc = gfm_codec_create(&codec, numData, numParity);
+        if (rc != GFM_OK)
+        {
+            fprintf(stderr, "skipping %u + %u: %s\n",
+                    numData, numParity, gfm_strerror(rc));
+            continue;
+        }
+
+        for (size_t bi = 0; bi < block.size(); bi++)
+        {
+            const size_t blockSize = block[bi];
+            attest(blockSize > 0, "block size must be > 0");
+            size_t numStripes = size / (numData * blockSize);
+            if (!numStripes) numStripes = 1;
+
+            // --huge-pages applies, --mem-limit doesn't
+            StripePool pool(numData + numParity, blockSize, numStripes,
+                            0, hugePages);
+            attest(pool.good(), "Unable to allocate %zu %u x %zu stripes",
+                   numStripes, numData + numParity, blockSize);
+            std::vector<uint8_t **> stripes(numStripes);
+            for (size_t s = 0; s < numStripes; s++)
+            {
+                stripes[s] = pool.Get();
+                // fault the pages in now rather than in the first run
+                memset(stripes[s][0], 0, (numData + numParity) * blockSize);
+            }
+            // --numa=local/remote: the same again on each node, only
+            // if asked for
+            std::vector<std::unique_ptr<StripePool> > nodePools;
+            std::vector<std::vector<uint8_t **> > nodeStripes;
+            for (size_t ni = 0; ni < numa.size(); ni++)
+            {
+                if ((numa[ni] == PLACE_OFF) || !nodePools.empty())
+                {
+                    continue;
+                }
+                for (int node = 0; node < Numa::nodes(); node++)
+                {
+                    nodePools.emplace_back(
+                        new StripePool(numData + numParity, blockSize,
+                                       numStripes, 0, hugePages, node));
+                    attest(nodePools.back()->good(),
+                           "Unable to allocate %zu %u x %zu stripes on node %d",
+                           numStripes, numData + numParity, blockSize, node);
+                    nodeStripes.push_back(std::vector<uint8_t **>(numStripes));
+                    for (size_t s = 0; s < numStripes; s++)
+                    {
+                        nodeStripes[node][s] = nodePools.back()->Get();
+                        memset(nodeStripes[node][s][0], 0,
+                               (numData + numParity) * blockSize);
+                    }
+                }
+            }
+
+            for (size_t ki = 0; ki < kernels.size(); ki++)
+            {
+                rc = gfm_codec_set_kernel(codec, kernels[ki].c_str());
+                attest(rc == GFM_OK, "kernel '%s' not supported",
+                       kernels[ki].c_str());
+
+                for (size_t ei = 0; ei < erasures.size(); ei++)
+                for (size_t ti = 0; ti < threads.size(); ti++)
+                for (size_t ni = 0; ni < numa.size(); ni++)
+                {
+                    unsigned e = erasures[ei];
+                    if (e == MAX_ERASURES) e = numParity;
+                    if (e > numParity) continue;
+                    unsigned t = threads[ti] ? threads[ti] : 1;
+
+                    // stripe s is done by thread s % t, on node
+                    // (s % t) % nodes
+                    std::vector<uint8_t **> placed(stripes);
+                    if (numa[ni] != PLACE_OFF)
+                    {
+                        const int nodes = Numa::nodes();
+                        for (size_t s = 0; s < numStripes; s++)
+                        {
+                            int node = (s % t) % nodes;
+                            if (numa[ni] == PLACE_REMOTE)
+                            {
+                                node = (node + 1) % nodes;
+                            }
+                            placed[s] = nodeStripes[node][s];
+                        }
+                    }
+
+                    Print(Run(codec, placed, blockSize, e, t, numa[ni]),
+                          json, first);
+                    first = false;
+                    fflush(stdout);
+                }
+            }
+        }
+        gfm_codec_destroy(codec);
+    }
+    if (json)
+    {
+        printf(first ? "[]\n" : "\n]\n");
+    }
+    return 0;
+}
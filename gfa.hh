@@ -1,3 +1,6 @@
+#ifndef GFA_HH
+#define GFA_HH
+
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
@@ -8,70 +11,128 @@
 #define DMP(x)  std::cerr << #x ": " << (x) << std::endl
 #define DMPX(x) std::cerr << #x ": 0x" << std::hex << ((int)(x)) << std::dec << std::endl
 
-// Gallois Field Arithmatic
-// uses 2 stages of lookup table to speed up arithmatic.
-class GFA
+// primitive polynomial
+// x**8 + x**4 + x**3 + x**2 + 1
+const uint8_t GFA_PRIM_POLY = 0x1d;
+
+// all the lookup tables, built by the compiler.
+struct GFATables
 {
-public:
-    // create an instance of the class to do arithmatic
-    GFA()
-        // we do this to allow negative indecies in gfilog
-        : gfilog(gflog + (2 * two2N))
-        {
-            uint8_t b = 1;
+    // log[a] for a != 0
+    uint8_t log[256];
+    // exp[255 + l] == 2 ** l for l in -255 .. 509, so
+    // the sum or difference of two logs needs no modulo
+    uint8_t exp[3 * 255];
+    // mult[(a << 8) + b] == a * b
+    uint8_t mult[256 * 256];
+    // "split nibble" tables for the SIMD kernels,
+    // lo[c][x] == c * x and hi[c][x] == c * (x << 4)
+    alignas(32) uint8_t lo[256][16];
+    alignas(32) uint8_t hi[256][16];
+    // multiplying by c as an 8x8 bit matrix for GF2P8AFFINEQB,
+    // byte (7 - i) of affine[c] says which bits of x make bit i
+    // of c * x, see GFA::affine()
+    uint64_t affine[256];
+};
 
-            // calculate the inverse log of every power of 2
-            for (uint8_t l = 0; l < mask; l++)
-            {
-                // b = 2 ** l, so log(b) = l ...
-                gflog[b]  = l;
-                // ... and inverse-log(l) = b
-                gfilog[l] = b;
-
-                // double b modulo the primitive polynomial
-                // (this is the gallois field magic)
-                b = (b << 1) ^ ((b & 0x80) ? primPoly : 0);
-            }
+constexpr GFATables GFAMakeTables()
+{
+    GFATables t = {};
+    uint8_t b = 1;
+
+    // calculate the inverse log of every power of 2
+    for (int l = 0; l < 255; l++)
+    {
+        // b = 2 ** l, so log(b) = l ...
+        t.log[b] = l;
+        // ... and inverse-log(l) = b, three times over
+        t.exp[l]       = b;
+        t.exp[l + 255] = b;
+        t.exp[l + 510] = b;
 
-            // copy the inverse-log table up and down so that
-            // gfilog[-mask .. 2*mask] are now valid
-            // this speeds up slowMult() and div() below
-            memcpy(gfilog - mask, gfilog, mask * sizeof(uint8_t));
-            memcpy(gfilog + mask, gfilog, mask * sizeof(uint8_t));
+        // double b modulo the primitive polynomial
+        // (this is the gallois field magic)
+        b = (b << 1) ^ ((b & 0x80) ? GFA_PRIM_POLY : 0);
+    }
 
-            // finally, create a lookup table for multiplications.
-            // multiplications are going to be used a lot, so
-            // this should be worth it ...
-            for (int a = 0; a < 256 ; a++)
+    // multiplications are going to be used a lot, so
+    // a lookup table should be worth it ...
+    for (int a = 1; a < 256; a++)
+    {
+        for (int b = 1; b < 256; b++)
+        {
+            t.mult[(a << 8) + b] = t.exp[255 + t.log[a] + t.log[b]];
+        }
+        for (int x = 0; x < 16; x++)
+        {
+            t.lo[a][x] = t.mult[(a << 8) + x];
+            t.hi[a][x] = t.mult[(a << 8) + (x << 4)];
+        }
+        // c * x is the sum of c * 2**j for each bit j of x
+        for (int i = 0; i < 8; i++)
+        {
+            uint64_t row = 0;
+            for (int j = 0; j < 8; j++)
             {
-                for (int b = 0; b < 256 ; b++)
-                {
-                    multLookup[(a << 8) + b] = slowMult(a, b);
-                }
+                row |= (uint64_t)((t.mult[(a << 8) + (1 << j)] >> i) & 1) << j;
             }
-        };
+            t.affine[a] |= row << (8 * (7 - i));
+        }
+    }
+    return t;
+}
+
+// Gallois Field Arithmatic
+// uses 2 stages of lookup table to speed up arithmatic.
+// The tables are static, shared by every instance and built at
+// compile time, so an instance costs nothing.
+class GFA
+{
+public:
+    static constexpr GFATables tables = GFAMakeTables();
 
     // GF log
-    uint8_t log(uint8_t a)
+    uint8_t log(uint8_t a) const
         {
             assert(a);
-            return gflog[a];
+            return tables.log[a];
         };
 
     // GF inverse log
-    uint8_t ilog(uint8_t a)
+    uint8_t ilog(uint8_t a) const
         {
-            return gfilog[a];
+            return tables.exp[255 + a];
         };
 
     // fast mult, just use the lookup table
-    inline uint8_t mult(uint8_t a, uint8_t b)
+    inline uint8_t mult(uint8_t a, uint8_t b) const
+        {
+            return tables.mult[(a << 8) + b];
+        };
+
+    // the row of the lookup table for multiplying by a,
+    // multRow(a)[b] == mult(a, b)
+    inline const uint8_t * multRow(uint8_t a) const
+        {
+            return tables.mult + (a << 8);
+        };
+
+    // what GF2P8AFFINEQB does with a matrix and a byte,
+    // affine(tables.affine[a], b) == mult(a, b)
+    static uint8_t affine(uint64_t m, uint8_t b)
         {
-            return multLookup[(a << 8) + b];
+            uint8_t ret = 0;
+            for (int i = 0; i < 8; i++)
+            {
+                // parity of the selected bits
+                uint8_t sel = (m >> (8 * (7 - i))) & b;
+                ret |= (__builtin_parity(sel) << i);
+            }
+            return ret;
         };
 
     // slow multiplication
-    uint8_t slowMult(uint8_t a, uint8_t b)
+    uint8_t slowMult(uint8_t a, uint8_t b) const
         {
             // (0 * 0) == (a * 0) == (0 * b) == 0
             if (!a || !b)
@@ -79,12 +140,12 @@ public:
                 return 0;
             }
             // a * b = 2 ** (log2(a) + log2(b))
-            return gfilog[(gflog[a] + gflog[b])];
+            return tables.exp[255 + tables.log[a] + tables.log[b]];
         };
 
     // division is only used when generating the recovery matrix, so no
     // point in creating a lookup table
-    uint8_t div(uint8_t a, uint8_t b)
+    uint8_t div(uint8_t a, uint8_t b) const
         {
             // (a / 0) = ERROR for all a
             assert(b);
@@ -94,26 +155,9 @@ public:
                 return 0;
             }
             // a / b = exp(log(a) - log(b))
-            return gfilog[gflog[a] - gflog[b]];
+            return tables.exp[255 + tables.log[a] - tables.log[b]];
         };
 
-private:
-
-    // primitive polynomial
-    // x**8 + x**4 + x**3 + x**2 + 1
-    static const uint8_t primPoly = 0x1d;
-    // 2 to the power of N, N = number of bits = 8
-    static const uint16_t two2N = 1 << (8 * sizeof(uint8_t));
-    // (2**N)-1 . Used often enough to make it worth while
-    static const uint8_t mask = two2N - 1;
-
-    // lookup table to speed up multiplication
-    uint8_t multLookup[two2N * two2N];
-    // lookup tables to speed up multiplication (used to create
-    // multLookup) and division
-    uint8_t   gflog[4 * two2N];
-    uint8_t * gfilog;
-
 private:
     // verify that (c == d), else print a,b,c,d and the message and die
     static void test(uint8_t a,
@@ -145,12 +189,12 @@ public:
             //log(0) ==-inf, so skip that one
             for (unsigned i = 1; i < 256; ++i)
             {
-                os << '\t' << (unsigned)gflog[i];
+                os << '\t' << (unsigned)log(i);
             }
             os << std::endl;
             for (unsigned i = 0; i < 255; ++i)
             {
-                os << '\t' << (unsigned)gfilog[i];
+                os << '\t' << (unsigned)ilog(i);
             }
             os << "\tX" << std::endl;
 
@@ -189,6 +233,9 @@ public:
                 test(0,a,mult(0,a),0, "0 * a != 0");
                 // verify that         a * 0 == 0
                 test(a,0,mult(a,0),0, "a * 0 != 0");
+                // ... and the bit matrices agree
+                test(0,a,affine(tables.affine[0],a),0, "affine(0)*a != 0");
+                test(a,0,affine(tables.affine[a],0),0, "affine(a)*0 != 0");
                 // unless a is zero ...
                 if(a)
                 {
@@ -217,6 +264,10 @@ public:
                     // verify that (a * b) == (b * a)
                     test(a, b, c, d, "a*b != b*a");
 
+                    // verify the bit matrix does (a * b) too
+                    d = affine(tables.affine[a], b);
+                    test(a, b, c, d, "affine(a)*b != a*b");
+
                     if(a)
                     {
                         // verify that ((a * b)/a) == b
@@ -229,3 +280,12 @@ public:
         };
 };
 
+// spot checks, the BIT() does the rest at run time
+static_assert(GFA::tables.mult[(2 << 8) + 0x80] == GFA_PRIM_POLY,
+              "2 * x**7 must wrap to the primitive polynomial");
+static_assert(GFA::tables.log[2] == 1, "log(2) != 1");
+static_assert(GFA::tables.hi[2][8] == GFA_PRIM_POLY, "bad nibble table");
+static_assert(GFA::tables.affine[1] == 0x0102040810204080ull,
+              "1 must be the identity matrix");
+
+#endif // GFA_HH
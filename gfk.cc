@@ -0,0 +1,752 @@
+#include "gfk.hh"
+#include "gfa.hh"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GFK_X86
+#endif
+
+// NEON is always there on aarch64, 32 bit ARM needs -mfpu=neon
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define GFK_NEON
+#endif
+
+// SVE2 only if the compiler was told it may use it (e.g.
+// -march=armv9-a), the CPU is checked at run time
+#if defined(__ARM_FEATURE_SVE2) && defined(__linux__)
+#include <arm_sve.h>
+#include <sys/auxv.h>
+#define GFK_SVE2
+#ifndef HWCAP2_SVE2
+#define HWCAP2_SVE2 (1 << 1)
+#endif
+#endif
+
+// the layouts that get fixed kernels, G(numData, numParity) each.
+// Override with 'make GEOMETRIES=...'
+#ifndef GFM_GEOMETRIES
+#define GFM_GEOMETRIES G(10, 4) G(8, 3) G(5, 5)
+#endif
+
+#define G(n, m) {n, m},
+const uint8_t gfGeometries[][2] = { GFM_GEOMETRIES {0, 0} };
+#undef G
+
+// K<numIn, numOut>::run for numOut in 1 .. OUT
+template <template <unsigned, unsigned> class K, unsigned IN, unsigned OUT>
+struct Fixed
+{
+    static GFKMatrix get(unsigned numOut)
+        {
+            return (numOut == OUT)
+                ? K<IN, OUT>::run
+                : Fixed<K, IN, OUT - 1>::get(numOut);
+        }
+};
+
+template <template <unsigned, unsigned> class K, unsigned IN>
+struct Fixed<K, IN, 0>
+{
+    static GFKMatrix get(unsigned)
+        {
+            return 0;
+        }
+};
+
+// the GFKMatrix of kernel K for numIn x numOut, if any of the
+// GFM_GEOMETRIES covers it
+template <template <unsigned, unsigned> class K>
+static GFKMatrix lookupFixed(unsigned numIn, unsigned numOut)
+{
+    GFKMatrix fn = 0;
+#define G(n, m)                                                 \
+    static_assert((n) * (m) <= GFK_MAX_FIXED, "geometry too big"); \
+    if (!fn && (numIn == (n)) && (numOut <= (m)))               \
+    {                                                           \
+        fn = Fixed<K, n, m>::get(numOut);                       \
+    }
+    GFM_GEOMETRIES
+#undef G
+    return fn;
+}
+
+// the original, one table lookup per byte
+static bool tableSupported()
+{
+    return true;
+}
+
+static void tableMulAdd(uint8_t * dst,
+                        const uint8_t * src,
+                        const uint8_t * mult,
+                        size_t len)
+{
+    for (size_t idx = 0; idx < len; idx++)
+    {
+        dst[idx] ^= mult[src[idx]];
+    }
+}
+
+// a word at a time, no vector registers needed
+static bool tableIsZero(const uint8_t * buff, size_t len)
+{
+    size_t idx = 0;
+    for (; (idx + 64) <= len; idx += 64)
+    {
+        uint64_t acc = 0;
+        for (unsigned w = 0; w < 8; w++)
+        {
+            uint64_t word;
+            memcpy(&word, buff + idx + (w * 8), 8);
+            acc |= word;
+        }
+        if (acc) return false;
+    }
+    for (; idx < len; idx++)
+    {
+        if (buff[idx]) return false;
+    }
+    return true;
+}
+
+// table lookups, but each input byte is read once and each output
+// byte written once
+template <unsigned IN, unsigned OUT>
+struct TableMatrix
+{
+    static void run(uint8_t * const * out,
+                    const uint8_t * const * in,
+                    const uint8_t * const * mult,
+                    size_t len)
+        {
+            for (size_t idx = 0; idx < len; idx++)
+            {
+                uint8_t acc[OUT] = {0,};
+#pragma GCC unroll 64
+                for (unsigned i = 0; i < IN; i++)
+                {
+                    uint8_t s = in[i][idx];
+#pragma GCC unroll 16
+                    for (unsigned o = 0; o < OUT; o++)
+                    {
+                        acc[o] ^= mult[(o * IN) + i][s];
+                    }
+                }
+#pragma GCC unroll 16
+                for (unsigned o = 0; o < OUT; o++)
+                {
+                    out[o][idx] = acc[o];
+                }
+            }
+        }
+};
+
+static GFKMatrix tableFixed(unsigned numIn, unsigned numOut)
+{
+    return lookupFixed<TableMatrix>(numIn, numOut);
+}
+
+#ifdef GFK_X86
+/*
+  "split nibble" multiplication, see Anvin section 6 (RAID-6 SSSE3).
+  c * x == c * (x & 0x0f) ^ c * (x & 0xf0), so two 16 entry tables
+  cover all of x and PSHUFB can do 16 (or 32) lookups at a time.
+  The tables are in GFA::tables, mult[1] is c itself.
+*/
+inline const __m128i * nibbleLo(const uint8_t * mult)
+{
+    return (const __m128i *)GFA::tables.lo[mult[1]];
+}
+
+inline const __m128i * nibbleHi(const uint8_t * mult)
+{
+    return (const __m128i *)GFA::tables.hi[mult[1]];
+}
+
+static bool ssse3Supported()
+{
+    return __builtin_cpu_supports("ssse3");
+}
+
+__attribute__((target("ssse3")))
+static void ssse3MulAdd(uint8_t * dst,
+                        const uint8_t * src,
+                        const uint8_t * mult,
+                        size_t len)
+{
+    const __m128i tlo  = _mm_load_si128(nibbleLo(mult));
+    const __m128i thi  = _mm_load_si128(nibbleHi(mult));
+    const __m128i mask = _mm_set1_epi8(0x0f);
+
+    size_t idx = 0;
+    for (; (idx + 16) <= len; idx += 16)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + idx));
+        __m128i l = _mm_shuffle_epi8(tlo, _mm_and_si128(s, mask));
+        __m128i h = _mm_shuffle_epi8(thi,
+                                     _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + idx));
+        d = _mm_xor_si128(d, _mm_xor_si128(l, h));
+        _mm_storeu_si128((__m128i *)(dst + idx), d);
+    }
+    // odd bytes at the end
+    tableMulAdd(dst + idx, src + idx, mult, len - idx);
+}
+
+__attribute__((target("ssse3")))
+static bool ssse3IsZero(const uint8_t * buff, size_t len)
+{
+    size_t idx = 0;
+    for (; (idx + 64) <= len; idx += 64)
+    {
+        __m128i acc = _mm_or_si128(
+            _mm_or_si128(_mm_loadu_si128((const __m128i *)(buff + idx)),
+                         _mm_loadu_si128((const __m128i *)(buff + idx + 16))),
+            _mm_or_si128(_mm_loadu_si128((const __m128i *)(buff + idx + 32)),
+                         _mm_loadu_si128((const __m128i *)(buff + idx + 48))));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xffff)
+        {
+            return false;
+        }
+    }
+    return tableIsZero(buff + idx, len - idx);
+}
+
+static bool avx2Supported()
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static void avx2MulAdd(uint8_t * dst,
+                       const uint8_t * src,
+                       const uint8_t * mult,
+                       size_t len)
+{
+    // same table in both lanes, VPSHUFB doesn't cross lanes
+    const __m256i tlo = _mm256_broadcastsi128_si256(
+        _mm_load_si128(nibbleLo(mult)));
+    const __m256i thi = _mm256_broadcastsi128_si256(
+        _mm_load_si128(nibbleHi(mult)));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+
+    size_t idx = 0;
+    for (; (idx + 32) <= len; idx += 32)
+    {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + idx));
+        __m256i l = _mm256_shuffle_epi8(tlo, _mm256_and_si256(s, mask));
+        __m256i h = _mm256_shuffle_epi8(thi,
+                                        _mm256_and_si256(_mm256_srli_epi64(s, 4), mask));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + idx));
+        d = _mm256_xor_si256(d, _mm256_xor_si256(l, h));
+        _mm256_storeu_si256((__m256i *)(dst + idx), d);
+    }
+    tableMulAdd(dst + idx, src + idx, mult, len - idx);
+}
+
+__attribute__((target("avx2")))
+static bool avx2IsZero(const uint8_t * buff, size_t len)
+{
+    size_t idx = 0;
+    for (; (idx + 128) <= len; idx += 128)
+    {
+        __m256i acc = _mm256_or_si256(
+            _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(buff + idx)),
+                            _mm256_loadu_si256((const __m256i *)(buff + idx + 32))),
+            _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(buff + idx + 64)),
+                            _mm256_loadu_si256((const __m256i *)(buff + idx + 96))));
+        if (!_mm256_testz_si256(acc, acc))
+        {
+            return false;
+        }
+    }
+    return tableIsZero(buff + idx, len - idx);
+}
+
+// the whole matrix 32 bytes at a time, the OUT accumulators stay in
+// registers and every input is loaded once
+template <unsigned IN, unsigned OUT>
+struct Avx2Matrix
+{
+    __attribute__((target("avx2")))
+    static void run(uint8_t * const * out,
+                    const uint8_t * const * in,
+                    const uint8_t * const * mult,
+                    size_t len)
+        {
+            __m256i tlo[OUT][IN];
+            __m256i thi[OUT][IN];
+            for (unsigned o = 0; o < OUT; o++)
+            {
+                for (unsigned i = 0; i < IN; i++)
+                {
+                    const uint8_t * m = mult[(o * IN) + i];
+                    tlo[o][i] = _mm256_broadcastsi128_si256(
+                        _mm_load_si128(nibbleLo(m)));
+                    thi[o][i] = _mm256_broadcastsi128_si256(
+                        _mm_load_si128(nibbleHi(m)));
+                }
+            }
+            const __m256i mask = _mm256_set1_epi8(0x0f);
+
+            size_t idx = 0;
+            for (; (idx + 32) <= len; idx += 32)
+            {
+                __m256i acc[OUT];
+#pragma GCC unroll 16
+                for (unsigned o = 0; o < OUT; o++)
+                {
+                    acc[o] = _mm256_setzero_si256();
+                }
+#pragma GCC unroll 64
+                for (unsigned i = 0; i < IN; i++)
+                {
+                    __m256i s = _mm256_loadu_si256((const __m256i *)(in[i] + idx));
+                    __m256i l = _mm256_and_si256(s, mask);
+                    __m256i h = _mm256_and_si256(_mm256_srli_epi64(s, 4), mask);
+#pragma GCC unroll 16
+                    for (unsigned o = 0; o < OUT; o++)
+                    {
+                        acc[o] = _mm256_xor_si256(
+                            acc[o],
+                            _mm256_xor_si256(_mm256_shuffle_epi8(tlo[o][i], l),
+                                             _mm256_shuffle_epi8(thi[o][i], h)));
+                    }
+                }
+#pragma GCC unroll 16
+                for (unsigned o = 0; o < OUT; o++)
+                {
+                    _mm256_storeu_si256((__m256i *)(out[o] + idx), acc[o]);
+                }
+            }
+            // odd bytes at the end
+            if (idx < len)
+            {
+                const uint8_t * tail[IN];
+                uint8_t * tailOut[OUT];
+                for (unsigned i = 0; i < IN; i++) tail[i] = in[i] + idx;
+                for (unsigned o = 0; o < OUT; o++) tailOut[o] = out[o] + idx;
+                TableMatrix<IN, OUT>::run(tailOut, tail, mult, len - idx);
+            }
+        }
+};
+
+static GFKMatrix avx2Fixed(unsigned numIn, unsigned numOut)
+{
+    return lookupFixed<Avx2Matrix>(numIn, numOut);
+}
+
+/*
+  GF2P8AFFINEQB multiplies every byte by an 8x8 bit matrix, so with
+  the matrix for c (GFA::tables.affine[c]) it does c * x for a whole
+  vector in one go, whatever the polynomial. GF2P8MULB would be
+  quicker still, but only knows the AES one (0x11b).
+*/
+static bool gfniSupported()
+{
+    return __builtin_cpu_supports("gfni") && __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("gfni,avx2")))
+static void gfniMulAdd(uint8_t * dst,
+                       const uint8_t * src,
+                       const uint8_t * mult,
+                       size_t len)
+{
+    const __m256i m = _mm256_set1_epi64x(GFA::tables.affine[mult[1]]);
+
+    size_t idx = 0;
+    for (; (idx + 32) <= len; idx += 32)
+    {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + idx));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + idx));
+        d = _mm256_xor_si256(d, _mm256_gf2p8affine_epi64_epi8(s, m, 0));
+        _mm256_storeu_si256((__m256i *)(dst + idx), d);
+    }
+    tableMulAdd(dst + idx, src + idx, mult, len - idx);
+}
+
+template <unsigned IN, unsigned OUT>
+struct GfniMatrix
+{
+    __attribute__((target("gfni,avx2")))
+    static void run(uint8_t * const * out,
+                    const uint8_t * const * in,
+                    const uint8_t * const * mult,
+                    size_t len)
+        {
+            __m256i m[OUT][IN];
+            for (unsigned o = 0; o < OUT; o++)
+            {
+                for (unsigned i = 0; i < IN; i++)
+                {
+                    m[o][i] = _mm256_set1_epi64x(
+                        GFA::tables.affine[mult[(o * IN) + i][1]]);
+                }
+            }
+
+            size_t idx = 0;
+            for (; (idx + 32) <= len; idx += 32)
+            {
+                __m256i acc[OUT];
+#pragma GCC unroll 16
+                for (unsigned o = 0; o < OUT; o++)
+                {
+                    acc[o] = _mm256_setzero_si256();
+                }
+#pragma GCC unroll 64
+                for (unsigned i = 0; i < IN; i++)
+                {
+                    __m256i s = _mm256_loadu_si256((const __m256i *)(in[i] + idx));
+#pragma GCC unroll 16
+                    for (unsigned o = 0; o < OUT; o++)
+                    {
+                        acc[o] = _mm256_xor_si256(
+                            acc[o], _mm256_gf2p8affine_epi64_epi8(s, m[o][i], 0));
+                    }
+                }
+#pragma GCC unroll 16
+                for (unsigned o = 0; o < OUT; o++)
+                {
+                    _mm256_storeu_si256((__m256i *)(out[o] + idx), acc[o]);
+                }
+            }
+            // odd bytes at the end
+            if (idx < len)
+            {
+                const uint8_t * tail[IN];
+                uint8_t * tailOut[OUT];
+                for (unsigned i = 0; i < IN; i++) tail[i] = in[i] + idx;
+                for (unsigned o = 0; o < OUT; o++) tailOut[o] = out[o] + idx;
+                TableMatrix<IN, OUT>::run(tailOut, tail, mult, len - idx);
+            }
+        }
+};
+
+static GFKMatrix gfniFixed(unsigned numIn, unsigned numOut)
+{
+    return lookupFixed<GfniMatrix>(numIn, numOut);
+}
+
+// same again, 64 bytes at a time
+static bool gfni512Supported()
+{
+    return __builtin_cpu_supports("gfni") &&
+        __builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("avx512bw");
+}
+
+__attribute__((target("gfni,avx512f,avx512bw")))
+static void gfni512MulAdd(uint8_t * dst,
+                          const uint8_t * src,
+                          const uint8_t * mult,
+                          size_t len)
+{
+    const __m512i m = _mm512_set1_epi64(GFA::tables.affine[mult[1]]);
+
+    size_t idx = 0;
+    for (; (idx + 64) <= len; idx += 64)
+    {
+        __m512i s = _mm512_loadu_si512((const void *)(src + idx));
+        __m512i d = _mm512_loadu_si512((const void *)(dst + idx));
+        d = _mm512_xor_si512(d, _mm512_gf2p8affine_epi64_epi8(s, m, 0));
+        _mm512_storeu_si512((void *)(dst + idx), d);
+    }
+    tableMulAdd(dst + idx, src + idx, mult, len - idx);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static bool avx512IsZero(const uint8_t * buff, size_t len)
+{
+    size_t idx = 0;
+    for (; (idx + 256) <= len; idx += 256)
+    {
+        __m512i acc = _mm512_or_si512(
+            _mm512_or_si512(_mm512_loadu_si512((const void *)(buff + idx)),
+                            _mm512_loadu_si512((const void *)(buff + idx + 64))),
+            _mm512_or_si512(_mm512_loadu_si512((const void *)(buff + idx + 128)),
+                            _mm512_loadu_si512((const void *)(buff + idx + 192))));
+        if (_mm512_test_epi64_mask(acc, acc))
+        {
+            return false;
+        }
+    }
+    return tableIsZero(buff + idx, len - idx);
+}
+
+template <unsigned IN, unsigned OUT>
+struct Gfni512Matrix
+{
+    __attribute__((target("gfni,avx512f,avx512bw")))
+    static void run(uint8_t * const * out,
+                    const uint8_t * const * in,
+                    const uint8_t * const * mult,
+                    size_t len)
+        {
+            __m512i m[OUT][IN];
+            for (unsigned o = 0; o < OUT; o++)
+            {
+                for (unsigned i = 0; i < IN; i++)
+                {
+                    m[o][i] = _mm512_set1_epi64(
+                        GFA::tables.affine[mult[(o * IN) + i][1]]);
+                }
+            }
+
+            size_t idx = 0;
+            for (; (idx + 64) <= len; idx += 64)
+            {
+                __m512i acc[OUT];
+#pragma GCC unroll 16
+                for (unsigned o = 0; o < OUT; o++)
+                {
+                    acc[o] = _mm512_setzero_si512();
+                }
+#pragma GCC unroll 64
+                for (unsigned i = 0; i < IN; i++)
+                {
+                    __m512i s = _mm512_loadu_si512((const void *)(in[i] + idx));
+#pragma GCC unroll 16
+                    for (unsigned o = 0; o < OUT; o++)
+                    {
+                        acc[o] = _mm512_xor_si512(
+                            acc[o], _mm512_gf2p8affine_epi64_epi8(s, m[o][i], 0));
+                    }
+                }
+#pragma GCC unroll 16
+                for (unsigned o = 0; o < OUT; o++)
+                {
+                    _mm512_storeu_si512((void *)(out[o] + idx), acc[o]);
+                }
+            }
+            // odd bytes at the end
+            if (idx < len)
+            {
+                const uint8_t * tail[IN];
+                uint8_t * tailOut[OUT];
+                for (unsigned i = 0; i < IN; i++) tail[i] = in[i] + idx;
+                for (unsigned o = 0; o < OUT; o++) tailOut[o] = out[o] + idx;
+                TableMatrix<IN, OUT>::run(tailOut, tail, mult, len - idx);
+            }
+        }
+};
+
+static GFKMatrix gfni512Fixed(unsigned numIn, unsigned numOut)
+{
+    return lookupFixed<Gfni512Matrix>(numIn, numOut);
+}
+#endif // GFK_X86
+
+#ifdef GFK_NEON
+/*
+  split nibbles again, TBL (VTBL on 32 bit ARM) instead of PSHUFB.
+*/
+inline uint8x16_t neonLookup(uint8x16_t table, uint8x16_t idx)
+{
+#ifdef __aarch64__
+    return vqtbl1q_u8(table, idx);
+#else
+    uint8x8x2_t t = {{vget_low_u8(table), vget_high_u8(table)}};
+    return vcombine_u8(vtbl2_u8(t, vget_low_u8(idx)),
+                       vtbl2_u8(t, vget_high_u8(idx)));
+#endif
+}
+
+// c * s, 16 bytes at a time
+inline uint8x16_t neonMult(uint8x16_t tlo, uint8x16_t thi, uint8x16_t s)
+{
+    return veorq_u8(neonLookup(tlo, vandq_u8(s, vdupq_n_u8(0x0f))),
+                    neonLookup(thi, vshrq_n_u8(s, 4)));
+}
+
+static bool neonSupported()
+{
+    // it was compiled in, so it had better be there
+    return true;
+}
+
+static void neonMulAdd(uint8_t * dst,
+                       const uint8_t * src,
+                       const uint8_t * mult,
+                       size_t len)
+{
+    const uint8x16_t tlo = vld1q_u8(GFA::tables.lo[mult[1]]);
+    const uint8x16_t thi = vld1q_u8(GFA::tables.hi[mult[1]]);
+
+    size_t idx = 0;
+    for (; (idx + 16) <= len; idx += 16)
+    {
+        uint8x16_t d = vld1q_u8(dst + idx);
+        d = veorq_u8(d, neonMult(tlo, thi, vld1q_u8(src + idx)));
+        vst1q_u8(dst + idx, d);
+    }
+    // odd bytes at the end
+    tableMulAdd(dst + idx, src + idx, mult, len - idx);
+}
+
+static bool neonIsZero(const uint8_t * buff, size_t len)
+{
+    size_t idx = 0;
+    for (; (idx + 64) <= len; idx += 64)
+    {
+        uint8x16_t acc = vorrq_u8(vorrq_u8(vld1q_u8(buff + idx),
+                                           vld1q_u8(buff + idx + 16)),
+                                  vorrq_u8(vld1q_u8(buff + idx + 32),
+                                           vld1q_u8(buff + idx + 48)));
+        uint64x2_t wide = vreinterpretq_u64_u8(acc);
+        if (vgetq_lane_u64(wide, 0) | vgetq_lane_u64(wide, 1))
+        {
+            return false;
+        }
+    }
+    return tableIsZero(buff + idx, len - idx);
+}
+
+template <unsigned IN, unsigned OUT>
+struct NeonMatrix
+{
+    static void run(uint8_t * const * out,
+                    const uint8_t * const * in,
+                    const uint8_t * const * mult,
+                    size_t len)
+        {
+            uint8x16_t tlo[OUT][IN];
+            uint8x16_t thi[OUT][IN];
+            for (unsigned o = 0; o < OUT; o++)
+            {
+                for (unsigned i = 0; i < IN; i++)
+                {
+                    const uint8_t c = mult[(o * IN) + i][1];
+                    tlo[o][i] = vld1q_u8(GFA::tables.lo[c]);
+                    thi[o][i] = vld1q_u8(GFA::tables.hi[c]);
+                }
+            }
+
+            size_t idx = 0;
+            for (; (idx + 16) <= len; idx += 16)
+            {
+                uint8x16_t acc[OUT];
+#pragma GCC unroll 16
+                for (unsigned o = 0; o < OUT; o++)
+                {
+                    acc[o] = vdupq_n_u8(0);
+                }
+#pragma GCC unroll 64
+                for (unsigned i = 0; i < IN; i++)
+                {
+                    uint8x16_t s = vld1q_u8(in[i] + idx);
+#pragma GCC unroll 16
+                    for (unsigned o = 0; o < OUT; o++)
+                    {
+                        acc[o] = veorq_u8(acc[o],
+                                          neonMult(tlo[o][i], thi[o][i], s));
+                    }
+                }
+#pragma GCC unroll 16
+                for (unsigned o = 0; o < OUT; o++)
+                {
+                    vst1q_u8(out[o] + idx, acc[o]);
+                }
+            }
+            // odd bytes at the end
+            if (idx < len)
+            {
+                const uint8_t * tail[IN];
+                uint8_t * tailOut[OUT];
+                for (unsigned i = 0; i < IN; i++) tail[i] = in[i] + idx;
+                for (unsigned o = 0; o < OUT; o++) tailOut[o] = out[o] + idx;
+                TableMatrix<IN, OUT>::run(tailOut, tail, mult, len - idx);
+            }
+        }
+};
+
+static GFKMatrix neonFixed(unsigned numIn, unsigned numOut)
+{
+    return lookupFixed<NeonMatrix>(numIn, numOut);
+}
+#endif // GFK_NEON
+
+#ifdef GFK_SVE2
+/*
+  Whatever the vector length, TBL with indices 0 .. 15 only looks at
+  the first 16 bytes, so the nibble tables are just replicated.
+  The predicate takes care of the odd bytes at the end.
+*/
+static bool sve2Supported()
+{
+    return getauxval(AT_HWCAP2) & HWCAP2_SVE2;
+}
+
+static void sve2MulAdd(uint8_t * dst,
+                       const uint8_t * src,
+                       const uint8_t * mult,
+                       size_t len)
+{
+    const svuint8_t tlo = svld1rq_u8(svptrue_b8(), GFA::tables.lo[mult[1]]);
+    const svuint8_t thi = svld1rq_u8(svptrue_b8(), GFA::tables.hi[mult[1]]);
+
+    for (size_t idx = 0; idx < len; idx += svcntb())
+    {
+        svbool_t pg = svwhilelt_b8_u64(idx, len);
+        svuint8_t s = svld1_u8(pg, src + idx);
+        svuint8_t l = svtbl_u8(tlo, svand_n_u8_x(pg, s, 0x0f));
+        svuint8_t h = svtbl_u8(thi, svlsr_n_u8_x(pg, s, 4));
+        svst1_u8(pg, dst + idx, sveor3_u8(svld1_u8(pg, dst + idx), l, h));
+    }
+}
+
+static bool sve2IsZero(const uint8_t * buff, size_t len)
+{
+    for (size_t idx = 0; idx < len; idx += svcntb())
+    {
+        svbool_t pg = svwhilelt_b8_u64(idx, len);
+        if (svptest_any(pg, svcmpne_n_u8(pg, svld1_u8(pg, buff + idx), 0)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+#endif // GFK_SVE2
+
+const GFK gfKernels[] =
+{
+#ifdef GFK_X86
+    {"gfni512", gfni512Supported, gfni512MulAdd, gfni512Fixed, avx512IsZero},
+    {"gfni",    gfniSupported,    gfniMulAdd,    gfniFixed,    avx2IsZero},
+    {"avx2",  avx2Supported,  avx2MulAdd,  avx2Fixed, avx2IsZero},
+    {"ssse3", ssse3Supported, ssse3MulAdd, 0,         ssse3IsZero},
+#endif
+#ifdef GFK_SVE2
+    {"sve2",  sve2Supported,  sve2MulAdd,  0,         sve2IsZero},
+#endif
+#ifdef GFK_NEON
+    {"neon",  neonSupported,  neonMulAdd,  neonFixed, neonIsZero},
+#endif
+    {"table", tableSupported, tableMulAdd, tableFixed, tableIsZero},
+    {0, 0, 0, 0, 0}
+};
+
+const GFK * gfKernel(const char * name)
+{
+    for (const GFK * k = gfKernels; k->name; k++)
+    {
+        if (name && *name && strcmp(name, k->name))
+        {
+            continue;
+        }
+        if (k->supported())
+        {
+            return k;
+        }
+        // asked for by name, but can't have it
+        if (name && *name)
+        {
+            return 0;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef GFK_HH
+#define GFK_HH
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Gallois Field Kernels
+// The inner loops of GFM::parity() and GFM::recover(), i.e.
+//     dst[0 .. len-1] ^= c * src[0 .. len-1]
+// in a few different flavours. 'mult' is the row of the
+// multiplication table for the constant, mult[x] == c * x,
+// see GFA::multRow(). It must be a row of GFA::tables, the SIMD
+// kernels use mult[1] (== c) to find their nibble tables.
+//
+// A kernel may also have versions of the whole matrix multiply,
+//     out[o][0 .. len-1] = sum of c[o][i] * in[i][0 .. len-1]
+// specialised at compile time for a given number of inputs and
+// outputs (see GFM_GEOMETRIES), mult[(o * numIn) + i] is the
+// multiplication table row for c[o][i].
+typedef void (*GFKMatrix)(uint8_t * const * out,
+                          const uint8_t * const * in,
+                          const uint8_t * const * mult,
+                          size_t len);
+
+struct GFK
+{
+    const char * name;
+    // can this CPU run it?
+    bool (*supported)();
+    void (*mulAdd)(uint8_t * dst,
+                   const uint8_t * src,
+                   const uint8_t * mult,
+                   size_t len);
+    // specialised matrix multiply for numIn x numOut,
+    // 0 if there isn't one (or no 'fixed' at all)
+    GFKMatrix (*fixed)(unsigned numIn, unsigned numOut);
+    // buff[0 .. len-1] all zero? Stops at the first non-zero chunk.
+    bool (*isZero)(const uint8_t * buff, size_t len);
+};
+
+// biggest numIn * numOut a fixed kernel may have
+const unsigned GFK_MAX_FIXED = 1024;
+
+// the (numData, numParity) layouts with fixed kernels, for
+// parity() and for recovering up to numParity rows,
+// terminated by {0, 0}
+extern const uint8_t gfGeometries[][2];
+
+// all the kernels built in, best first, terminated by a 0 name
+extern const GFK gfKernels[];
+
+// look up a kernel by name, 0 (or "") for the best one this CPU
+// supports. Returns 0 if the kernel is unknown or unsupported.
+const GFK * gfKernel(const char * name);
+
+#endif // GFK_HH
@@ -1,12 +1,28 @@
-#include "gfa.hh"
+#include "gfm.hh"
 #include "git.h"
-
+#include "libgfm.h"
+#include "numa.hh"
+#include "pool.hh"
+#include "probes.hh"
+#include "stats.hh"
+#include "throttle.hh"
+#include "verify.hh"
+#include "wire.hh"
+#include "zstage.hh"
+
+#include <algorithm>
 #include <assert.h>
+#include <atomic>
+#include <condition_variable>
 #include <errno.h>
 #include <fcntl.h>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <openssl/evp.h>
 #include <sstream>
 #include <stdarg.h>
@@ -15,17 +31,29 @@
 #include <stdlib.h>
 #include <string.h>
 #include <string>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <thread>
 #include <unistd.h>
+#include <vector>
 
-extern const char _binary_gfm_tar_start;
-extern const char _binary_gfm_tar_end;
+extern const char _binary_gfm_tar_start[];
+extern const char _binary_gfm_tar_end[];
 
 std::ofstream dumpFile;
 
 size_t blobSize();
 size_t  _binary_gfm_tar_len = blobSize();
 
+int Bench(int argc, char ** argv);
+int Batch(const char * manifest, unsigned numJobs, unsigned numIo);
+int StreamEncode(const gfm_codec * codec, int in, const std::string & stub,
+                 size_t blockSize, uint8_t blocksizePo2, unsigned depth);
+int StreamDecode(const std::string & stub, int out,
+                 size_t blockSize, uint8_t blocksizePo2);
+
 /// needs to be the same for parity gerneration and recovery.
 /// Choose multiples of 512 'cos that's one disk sector.
 /// larger values _might_ make it go faster
@@ -33,7 +61,86 @@ size_t  _binary_gfm_tar_len = blobSize();
 const uint8_t BLOCKSIZE_Po2 = 12;
 const size_t  BLOCKSIZE     = 1 << BLOCKSIZE_Po2;
 
+/// stripes in flight between the reader, compute and writer stages,
+/// unless --mem-limit says fewer
+const size_t PIPELINE_DEPTH = 8;
+/// --mem-limit, bytes of stripe buffers (0 == no limit)
+size_t memLimit = 0;
+/// --huge-pages
+bool hugePages = false;
+/// --io-limit, reads and writes in progress at once (0 == no limit)
+Semaphore * ioLimit = 0;
+
+// holds one of the --io-limit slots (if any) while in scope.
+// Only for files: a read of one of our own pipes waits on a thread
+// that may need a slot itself to fill it.
+struct IoSlot
+{
+    IoSlot(bool want = true)
+        : held(want && ioLimit)
+        {
+            if (held) ioLimit->Acquire();
+        }
+    ~IoSlot()
+        {
+            if (held) ioLimit->Release();
+        }
+
+    const bool held;
+};
+
+/// --range=OFFSET[:LENGTH], a length of 0 is to the end
+bool     wantRange   = false;
+uint64_t rangeOffset = 0;
+uint64_t rangeLength = 0;
+
+/*
+  Which shard has which row of the code (data first, then parity) in
+  a stripe. Normally shard N has row N throughout. With --rotate they
+  all move one shard to the left every 'every' stripes, as in RAID-5's
+  left-symmetric layout, so the data (and with it the reads of a
+  healthy recovery) is spread over all the shards. The stripe buffers
+  stay in row order, only which shard each row is read from or
+  written to changes.
+*/
+struct Layout
+{
+    int      rows;
+    uint32_t every;
+
+    int shift(uint64_t stripe) const
+        {
+            return every ? ((stripe / every) % rows) : 0;
+        }
+    // the row shard 'idx' has in 'stripe'
+    int row(int idx, uint64_t stripe) const
+        {
+            return (idx + shift(stripe)) % rows;
+        }
+    // the shard with row 'row' of 'stripe'
+    int shard(int row, uint64_t stripe) const
+        {
+            return (row + rows - shift(stripe)) % rows;
+        }
+};
+
+// a stripe on its way from one stage to the next
+typedef struct _stripe
+{
+    // 0 marks the end of the stream
+    uint8_t ** buff;
+    uint64_t   index;
+    // bytes read (or to write)
+    ssize_t    numRead;
+    // recovery: for the shards this stripe was read from
+    const gfm_decoder * rcvr;
+    // all zeros, so no parity to compute (or data to recover) and
+    // holes rather than blocks in the shards
+    bool       zero;
+} Stripe;
+
 // Signature prepended to data and parity files.
+// This is all the old (unversioned) shards have, after the tarball.
 typedef struct _signature
 {
     uint8_t numData;
@@ -42,6 +149,139 @@ typedef struct _signature
     uint8_t blocksizePo2;
 } signature;
 
+/// tar works in blocks of this
+const size_t TAR_BLOCK = 512;
+
+// Shard header, at SHARD_HEADER_AT of every shard. In a shard with
+// the tarball that's in the unused tail of its (v7) tar header, so
+// the shard is still a tarball, in one without it's the only thing
+// in the first block. Later versions may only add to the end, and
+// say how long it is in headerLen. On disk (see PackHeader()) each
+// field is at a fixed offset, little-endian:
+//
+//    0  magic            10  numBlobs
+//    4  version          11  compression
+//    5  headerLen        12  blobLen (32 bits)
+//    6  numData          16  dataOffset (32 bits)
+//    7  numParity        20  numGroups, version 2 on
+//    8  fileNum          21  rotate (32 bits), version 4 on
+//    9  blocksizePo2
+//
+// Version 3 had rotate at 24, after the padding of an x86-64 struct.
+typedef struct _shardHeader
+{
+    char     magic[4];
+    uint8_t  version;
+    uint8_t  headerLen;
+    uint8_t  numData;
+    uint8_t  numParity;
+    uint8_t  fileNum;
+    uint8_t  blocksizePo2;
+    // the first numBlobs shards have the tarball
+    uint8_t  numBlobs;
+    // of the stream, SHARD_PLAIN or SHARD_ZSTD
+    uint8_t  compression;
+    // bytes of tarball at the start of this shard, 0 for none
+    uint32_t blobLen;
+    // where the first block is
+    uint32_t dataOffset;
+    // version 2: local groups (--lrc), their parity shards follow
+    // the numParity global ones
+    uint8_t  numGroups;
+    // version 3: the roles move on a shard every this many stripes
+    // (--rotate), 0 if they don't
+    uint32_t rotate;
+} shardHeader;
+
+const char    SHARD_MAGIC[4]  = {'G', 'F', 'M', 'S'};
+const uint8_t SHARD_VERSION   = 4;
+const size_t  SHARD_HEADER_AT = 0x180;
+/// bytes of it this version writes
+const uint8_t SHARD_HEADER_LEN = 25;
+static_assert(SHARD_HEADER_AT + 28 <= TAR_BLOCK,
+              "shard header must fit in the first tar block");
+
+// 'hdr' as it goes on disk, SHARD_HEADER_LEN bytes at 'out'
+void PackHeader(const shardHeader & hdr, uint8_t * out)
+{
+    memcpy(out, hdr.magic, sizeof(hdr.magic));
+    out[4]  = hdr.version;
+    out[5]  = SHARD_HEADER_LEN;
+    out[6]  = hdr.numData;
+    out[7]  = hdr.numParity;
+    out[8]  = hdr.fileNum;
+    out[9]  = hdr.blocksizePo2;
+    out[10] = hdr.numBlobs;
+    out[11] = hdr.compression;
+    putLE32(out + 12, hdr.blobLen);
+    putLE32(out + 16, hdr.dataOffset);
+    out[20] = hdr.numGroups;
+    putLE32(out + 21, hdr.rotate);
+}
+
+// ... and back, from the first block of a shard. false if it isn't
+// a shard header (or is too short to be one). The fields an older
+// version didn't have are 0.
+bool UnpackHeader(const uint8_t * block, shardHeader & hdr)
+{
+    const uint8_t * in = block + SHARD_HEADER_AT;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, in, sizeof(hdr.magic));
+    hdr.version   = in[4];
+    hdr.headerLen = in[5];
+    if (memcmp(hdr.magic, SHARD_MAGIC, sizeof(hdr.magic)) ||
+        !hdr.version || (hdr.headerLen < 20) ||
+        ((SHARD_HEADER_AT + hdr.headerLen) > TAR_BLOCK))
+    {
+        return false;
+    }
+    hdr.numData      = in[6];
+    hdr.numParity    = in[7];
+    hdr.fileNum      = in[8];
+    hdr.blocksizePo2 = in[9];
+    hdr.numBlobs     = in[10];
+    hdr.compression  = in[11];
+    hdr.blobLen      = getLE32(in + 12);
+    hdr.dataOffset   = getLE32(in + 16);
+    if (hdr.headerLen > 20)
+    {
+        hdr.numGroups = in[20];
+    }
+    if ((hdr.version == 3) && (hdr.headerLen >= 28))
+    {
+        hdr.rotate = getLE32(in + 24);
+    }
+    else if ((hdr.version >= 4) && (hdr.headerLen >= 25))
+    {
+        hdr.rotate = getLE32(in + 21);
+    }
+    return true;
+}
+
+/// --blobs=N, the tarball goes in the first N shards (-1 for all)
+int numBlobs = -1;
+/// --lrc=GROUPS, local parity for that many groups of data shards
+unsigned lrcGroups = 0;
+/// --rotate[=N], move the data and parity around every N stripes
+uint32_t rotateStripes = 0;
+/// --stream[=DEPTH], one interleaved stream (0 for shard files)
+unsigned streamDepth = 0;
+/// --numa[=NODE], the coding and its stripe buffers on NODE
+/// (NUMA_AUTO: where it started, or with --batch over all of them)
+int      numaNode    = NUMA_ANY;
+/// --numa-io=NODE|auto, readers and writers on NODE (NUMA_AUTO: the
+/// one the disk they're using hangs off)
+int      numaIo      = NUMA_ANY;
+/// --zstd[=LEVEL], compress the stream first
+bool     useZstd     = false;
+int      zstdLevel   = 3;
+/// --zstd-threads=N, 0 for one per CPU
+unsigned zstdThreads = 0;
+/// --hedge[=N], read N more shards than needed (-1 for off)
+int      hedgeExtra  = -1;
+/// --verify, check against STUB.md5 while recovering
+bool     wantVerify  = false;
+
 // fancy assert
 void attest(bool test, const char * epilogue = "oops", ...)
 {
@@ -61,12 +301,12 @@ void attest(bool test, const char * epilogue = "oops", ...)
 size_t blobSize()
 {
     size_t rawSize =
-        &_binary_gfm_tar_end -
-        &_binary_gfm_tar_start;
+        _binary_gfm_tar_end -
+        _binary_gfm_tar_start;
 
     char * endptr = 0;
     uint32_t s = strtol(
-        (&_binary_gfm_tar_start) + 124,
+        (_binary_gfm_tar_start) + 124,
         &endptr, 8);
     attest(endptr && (*endptr == '\0'),
            "unable to decode file size from tar header");
@@ -76,871 +316,1400 @@ size_t blobSize()
     return s;
 }
 
-/// Gallois Field Matrix
-class GFM
+// create a codec, using the GF kernel named in GFM_KERNEL if set
+gfm_codec * MakeCodec(const uint8_t numData,
+                      const uint8_t numParity,
+                      const uint8_t numGroups)
 {
-public:
-    GFM(uint8_t _numData, uint8_t _numParity)
-        : numData(_numData)
-        , numParity(_numParity)
-        {
-            int rows = numData + numParity;
-            // could go as high as 255, but 250
-            // is neater
-            attest(rows <= 250, "Unable to create %i rows, limited to 250", rows);
-
-            // create an array to calculate the parity
-            d = makeArray(rows, numData + 1);
-/*
-            NEW AND IMPROVED
-            based on original and updated papers
+    gfm_codec * codec = 0;
+    int rc = gfm_codec_create(&codec, numData, numParity, &dumpFile,
+                              numGroups);
+    attest(rc == GFM_OK, "Unable to create %u + %u (%u groups) codec: %s",
+           numData, numParity, numGroups, gfm_strerror(rc));
+
+    const char * kernel = getenv("GFM_KERNEL");
+    if (kernel)
+    {
+        attest(gfm_codec_set_kernel(codec, kernel) == GFM_OK,
+               "GF kernel '%s' unknown or not supported", kernel);
+    }
+    return codec;
+}
 
-http://web.eecs.utk.edu/~plank/plank/papers/CS-03-504.pdf
-http://web.eecs.utk.edu/~plank/plank/papers/CS-03-504.pdf
+// the stripe buffers for the stages, within --mem-limit
+StripePool * MakePool(size_t rows)
+{
+    StripePool * pool = new StripePool(rows, BLOCKSIZE, PIPELINE_DEPTH,
+                                       memLimit, hugePages, Numa::current());
+    attest(pool->good(), "Unable to allocate a %zu x %zu stripe%s",
+           rows, BLOCKSIZE,
+           memLimit ? " within --mem-limit" : "");
+    return pool;
+}
 
-            Start with a "Vandermode" matrix, which is guaranteed
-            invertible if you reduce and numParity rows
+// --numa-io: move the calling reader or writer thread to the node
+// given, or for 'auto' the one the device under 'fd' is attached to.
+// Otherwise it stays with the coding.
+void IoNear(int fd)
+{
+    const int node = (numaIo == NUMA_AUTO) ? Numa::nodeOf(fd) : numaIo;
+    if (node >= 0)
+    {
+        Numa::runOn(node);
+    }
+}
 
-            [0^0 0^1 0^2 ...   [1 0 0
-            [1^0 1^1 1^2 ...   [1 1 1
-            [2^0 2^1 2^2 ...   [1 2
-            [3^0 3^1 3^2 ...   [1 3
-            [4^0 4^1 4^2 ...   [1 4
+std::string MakeFilename(const std::string & stub, int num)
+{
+    std::ostringstream o;
+    o << (stub);
+    o << std::setw(2) << std::setfill('0') << std::hex << num;
 
-*/
-            // first row, add 1 (makeArray initialises to)
-            d[0][0] = 1;
-            // second row all 1
-            for (int col = 0; col < numData; col++)
-            {
-                d[1][col] = 1;
-            }
-            // third and successive rows
-            for (int row = 2; row < rows; row++)
-            {
-                // first column, all 1
-                d[row][0] = 1;
-                // second column, row number
-                d[row][1] = row;
-                // rest of the columns, powers of "row"
-                for (int col = 2; col < numData; col++)
-                {
-                    d[row][col] = gfa.mult(d[row][col-1], row);
-                }
-            }
-            print("Vandermonde", dumpFile);
-/*
-            now we have to apply "elementary operations"
-            to reduce the top part into an identity matrix
-            first row is already in the right format
-*/
-            for (int row = 1; row < numData; ++row)
-            {
-                // we need to make d[row][row] == 1 and
-                // the rest of row == 0 without disturbing the previous
-                // rows.
-                // first, ensure that d[row][row] is non-zero,
-                // swap with a later column if needed
-                if (!d[row][row])
-                {
-                    for (int col = row+1; col < numData; ++col)
-                    {
-                        if (!d[row][col]) continue;
-                        // found a candidate column to swap with
-                        for (int idx = row; idx < rows; ++idx)
-                        {
-                            uint8_t tmp = d[idx][row];
-                            d[idx][row] = d[idx][col];
-                            d[idx][col] = tmp;
-                        }
-                        break;
-                    }
-//                    print("swapped...");
-                }
-                // scale if necessary to ensure a major diagonal of 1
-                if (d[row][row] != 1)
-                {
-                    uint8_t inv = gfa.div(1,d[row][row]);
-                    for (int col = 0; col < numData; ++col)
-                    {
-                        d[row][col] = gfa.mult(inv,d[row][col]);
-                    }
-//                    print("scaled...");
-                }
-                // now zero-out the other columns
-                for (int col = 0; col < numData; ++col)
-                {
-                    // leave the major diagonal alone
-                    if (row == col) continue;
-                    // already zero?
-                    if (!d[row][col]) continue;
-                    // take away multiples of the row'th column
-                    uint8_t mult = d[row][col];
-                    for (int idx = row; idx < rows; ++idx)
-                    {
-                        d[idx][col] ^= gfa.mult(mult,d[idx][row]);
-                    }
-                }
-//                print("reduced...");
-            }
-            print("Parity", dumpFile);
-            // make sure we got it right...
-            // identity matrix at the top
-            for (int row = 0; row < numData; ++row)
-            {
-                for (int col = 0; col < numData; ++col)
-                {
-                    assert(d[row][col] == (row == col) ? 1 : 0);
-                }
-            }
-            // the rest must not be zero
-            for (int row = numData; row < rows; ++row)
-            {
-                for (int col = 0; col < numData; ++col)
-                {
-                    assert(d[row][col]);
-                }
-            }
-        };
-
-    // ye olde destructor
-    virtual ~GFM()
-        {
-            free(d);
-            d = 0;
-        }
-
-    // helper function to create a 2-dimensional array of
-    // bytes that can be free'd with a single free().
-    // More importantly, the rows are arranged such that
-    // [n][cols] == [n+1][0] so we can read/write the
-    // whole thing with a single call
-    static uint8_t ** makeArray(size_t rows, size_t cols)
-        {
-            int numCells = rows * cols;
-            // allocate enough memory for the backbone and the cells
-            ssize_t size =
-                (rows     * sizeof(uint8_t *)) +
-                (numCells * sizeof(uint8_t));
-            uint8_t ** ret = (uint8_t **)calloc(size,1);
-            attest(ret, "Unable to create %u x %u matrix", rows, cols);
-
-            // first row starts just after the backbone
-            ret[0] = (uint8_t *)&ret[rows];
-            // subsequent rows abut
-            for (size_t i = 1; i < rows; i++)
-            {
-                ret[i] = ret[i-1] + cols;
-            }
-            return ret;
-        }
+    return o.str();
+}
 
-    // calculate the parity bits for a whole block of data
-    //  data [0..len-1][0..(numData+numParity-1]
-    inline void parity(uint8_t ** data, size_t len)
-        {
-            // clear all the rows corresponding to the parity bytes
-            memset(data[numData], 0, (len * numParity));
-            // process the parity bytes one at a time
-            for (int row = numData; row < (numData + numParity); row++)
-            {
-                // cycle through each data bit for each parity bit
-                for (int col = 0; col < numData; col++)
-                {
-                    // process the data one byte at a time
-                    for (size_t idx = 0; idx < len; idx++)
-                    {
-                        // row and col are fixed, compiler should be able
-                        // to optimise this nicely
-                        data[row][idx] ^= gfa.mult(data[col][idx], d[row][col]);
-                    }
-                }
-            }
-        }
+// the v7 tar header checksum: the sum of the bytes of the block, the
+// checksum field counting as spaces
+unsigned tarChecksum(const uint8_t * block)
+{
+    unsigned sum = 0;
+    for (size_t idx = 0; idx < TAR_BLOCK; idx++)
+    {
+        sum += ((idx >= 148) && (idx < 156)) ? ' ' : block[idx];
+    }
+    return sum;
+}
 
-    // calculate the parity for a single block of data
-    inline void parity(uint8_t * data)
+// does the block look like a tar header?
+bool isTarHeader(const uint8_t * block)
+{
+    char field[9] = {0,};
+    memcpy(field, block + 148, 8);
+    char * endptr = 0;
+    unsigned long chk = strtoul(field, &endptr, 8);
+    return (endptr != field) && (chk == tarChecksum(block));
+}
+
+// the first block and padding, then the blocks follow at hdr.dataOffset
+void writeHeader(int fd, const shardHeader & hdr, EVP_MD_CTX * ctx)
+{
+    IoSlot io;
+    const uint64_t w = throttle.start();
+    uint8_t block[TAR_BLOCK];
+    memset(block, 0, sizeof(block));
+    if (hdr.blobLen)
+    {
+        memcpy(block, _binary_gfm_tar_start, TAR_BLOCK);
+        for (size_t idx = SHARD_HEADER_AT; idx < TAR_BLOCK; idx++)
         {
-            // output = matrix * data
-            // the first numData elements of output are just the data
-            // which is kind of boring, so let's just do the last bit
-            uint8_t * parity = data + numData;
-            for (int row = numData; row < (numData + numParity); row++)
-            {
-                *parity = 0;
-                for (int col = 0; col < numData; col++)
-                {
-                    *parity ^= gfa.mult(data[col], d[row][col]);
-                }
-                parity++;
-            }
+            attest(!block[idx], "tarball header has no room for the shard header");
         }
+    }
+    PackHeader(hdr, block + SHARD_HEADER_AT);
+    if (hdr.blobLen)
+    {
+        // it's a different tar header now
+        snprintf((char*)block + 148, 8, "%06o", tarChecksum(block));
+        block[155] = ' ';
+    }
+    attest(write(fd, block, TAR_BLOCK) == (ssize_t)TAR_BLOCK,
+           "Unable to write shard header");
+    EVP_DigestUpdate(ctx, block, TAR_BLOCK);
 
-    // mark a data (or parity) set as failed.
-    void failData(uint8_t idx)
+    size_t done = TAR_BLOCK;
+    if (hdr.blobLen)
+    {
+        size_t len = hdr.blobLen - TAR_BLOCK;
+        attest(write(fd, _binary_gfm_tar_start + TAR_BLOCK, len) == (ssize_t)len,
+               "Unable to write tarball");
+        EVP_DigestUpdate(ctx, _binary_gfm_tar_start + TAR_BLOCK, len);
+        done += len;
+    }
+
+    static const char pad[BLOCKSIZE] = {0,};
+    ssize_t len = hdr.dataOffset - done;
+    attest((len >= 0) && (len <= (ssize_t)BLOCKSIZE), "bad shard data offset");
+    attest(write(fd, pad, len) == len,
+           "Unable to write pad");
+    EVP_DigestUpdate(ctx, pad, len);
+    throttle.Write(hdr.dataOffset, w, hdr.fileNum);
+}
+
+// read all 'len' bytes unless it's the end, closing 'fd' if it is.
+// 'isPipe' for one of gfm's own pipes, which isn't --io-limit I/O.
+ssize_t readFully(int fd, void * buff, ssize_t len, bool isPipe = false)
+{
+    // previously read
+    ssize_t prev = 0;
+    // number of bytes read this (first) time
+    ssize_t rc;
+    {
+        IoSlot io(!isPipe);
+        rc = read(fd, buff, len);
+    }
+    stats.syscall(Stats::READ, rc < len);
+    while(rc > 0)
+    {
+        if ((rc + prev) == len)
+	{
+            // read it all, bye!
+            return len;
+	}
+        prev += rc;
+        IoSlot io(!isPipe);
+        rc = read(fd, ((char*)buff) + prev, len - prev);
+        stats.syscall(Stats::READ, rc < (len - prev));
+    }
+    // EOF or some other error, close the file!
+    close(fd);
+    return (rc < 0) ? rc : prev;
+}
+
+// GFM_DELAY=IDX:MS[,IDX:MS...] makes every read of shard IDX (the
+// hex at the end of its filename) take MS milliseconds longer, to
+// see what a slow disk does to recovery
+static unsigned shardDelay[250];
+
+void ParseDelays(const char * spec)
+{
+    while (spec && *spec)
+    {
+        char * end = 0;
+        unsigned long idx = strtoul(spec, &end, 16);
+        attest((end != spec) && (*end == ':') && (idx < 250),
+               "Bad GFM_DELAY, expected IDX:MS[,IDX:MS...]: '%s'", spec);
+        spec = end + 1;
+        shardDelay[idx] = strtoul(spec, &end, 0);
+        attest((end != spec) && (!*end || (*end == ',')),
+               "Bad GFM_DELAY, expected IDX:MS[,IDX:MS...]: '%s'", spec);
+        spec = *end ? end + 1 : end;
+    }
+}
+
+// a run of hole (or data) in a shard, as SEEK_DATA / SEEK_HOLE last
+// said, so they're only asked where one ends and the next begins
+struct Extent
+{
+    int   fd;
+    off_t from;
+    off_t to;
+    bool  hole;
+};
+static Extent shardExtent[250];
+
+// is [off, off + len) of shard 'idx' a hole, zeros without reading?
+// Where the filesystem can't tell it's all data.
+bool ShardHole(int fd, unsigned idx, off_t off, size_t len)
+{
+    Extent & e = shardExtent[idx];
+    if ((e.fd != fd) || (off < e.from) || (off >= e.to))
+    {
+        e.fd   = fd;
+        e.from = off;
+        e.hole = false;
+        e.to   = off + len;
+        off_t data = lseek(fd, off, SEEK_DATA);
+        struct stat st;
+        if ((data < 0) && (errno == ENXIO) &&
+            !fstat(fd, &st) && (off < st.st_size))
         {
-            assert(idx < (numData + numParity));
-            d[idx][numData] = -1;
+            // hole all the way to the end
+            e.hole = true;
+            e.to   = st.st_size;
         }
-    void failParity(uint8_t idx)
+        else if (data > off)
         {
-            failData(idx + numData);
+            e.hole = true;
+            e.to   = data;
         }
-    bool failed(uint8_t idx)
+        else if (data == off)
         {
-            // -1 == failed
-            if (d[idx][numData] == (uint8_t)-1) return true;
-            // must be -1 or 0 ...
-            assert(!d[idx][numData]);
-            return false;
+            off_t hole = lseek(fd, off, SEEK_HOLE);
+            e.to = std::max<off_t>(hole, off + len);
         }
+    }
+    return e.hole && ((off_t)(off + len) <= e.to);
+}
 
+// a block of shard 'idx', timed (and delayed) per shard. A hole is
+// just zeros, 'hole' (if given) says if that's what it was.
+ssize_t ShardRead(int fd, unsigned idx, void * buff, size_t len, off_t off,
+                  bool * hole = 0)
+{
+    uint64_t t = stats.start();
+    const bool isHole = ShardHole(fd, idx, off, len);
+    if (hole)
+    {
+        *hole = isHole;
+    }
+    if (isHole)
+    {
+        memset(buff, 0, len);
+        stats.shard(idx, t);
+        return len;
+    }
+    if (shardDelay[idx])
+    {
+        usleep(shardDelay[idx] * 1000);
+    }
+    ssize_t got;
+    {
+        IoSlot io;
+        got = pread(fd, buff, len, off);
+    }
+    stats.shard(idx, t);
+    if (got > 0)
+    {
+        throttle.Read(got, idx);
+    }
+    return got;
+}
+
+std::string StripDir(const std::string & filename)
+{
+    size_t found = filename.find_last_of("/\\");
+    // make sure fn doesn't get gc'ed which fn.c_str is in use!
+    return filename.substr(found+1);
+}
+
+// print out the MD checksums
+void PrintMD(FILE * file,
+	     const std::string & filename,
+	     EVP_MD_CTX * ctx)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int  digestLen = sizeof(digest);
+    EVP_DigestFinal_ex(ctx, digest, &digestLen);
+
+    unsigned i;
+    for (i = 0; i < digestLen; i++)
+    {
+        fprintf(file, "%02x", (digest[i] & 0xFF));
+    }
+    // make sure fn doesn't get gc'ed which fn.c_str is in use!
+    std::string fn = StripDir(filename);
+    fprintf(file, "  %s\n", fn.c_str());
+
+    EVP_MD_CTX_free(ctx);
+}
+
+/*
+  STUB.shards, written along with STUB.md5 so recovery can open the
+  shards straight away instead of probing for them:
+
+    # gfm shard set
+    version 1
+    geometry NUM_DATA NUM_PARITY
+    groups NUM_GROUPS
+    rotate STRIPES
+    blocksize 4096
+    compression 0
+    blocks NUM_BLOCKS
+    shard IDX DATA_OFFSET LENGTH
+    ...
+*/
+const unsigned MANIFEST_VERSION = 1;
+
+void WriteManifest(const std::string & stub, const shardHeader & hdr,
+                   const uint32_t * dataOffset, uint64_t numBlocks)
+{
+    std::string filename = stub + ".shards";
+    FILE * file = fopen(filename.c_str(), "w");
+    attest(file, "Unable to open manifest: '%s'", filename.c_str());
+    fprintf(file,
+            "# gfm shard set\n"
+            "version %u\n"
+            "geometry %u %u\n"
+            "groups %u\n"
+            "rotate %u\n"
+            "blocksize %zu\n"
+            "compression %u\n"
+            "blocks %llu\n",
+            MANIFEST_VERSION,
+            hdr.numData, hdr.numParity,
+            hdr.numGroups,
+            hdr.rotate,
+            BLOCKSIZE,
+            hdr.compression,
+            (unsigned long long)numBlocks);
+    for (int idx = 0; idx < (hdr.numData + hdr.numParity + hdr.numGroups); idx++)
+    {
+        fprintf(file, "shard %02x %u %llu\n", idx, dataOffset[idx],
+                (unsigned long long)(dataOffset[idx] + (numBlocks * BLOCKSIZE)));
+    }
+    attest(!fclose(file), "Unable to write manifest: '%s'", filename.c_str());
+}
+
+// is 'fd' shard 'idx' as listed in the manifest? Shorter is cut
+// short, that's dealt with later. Leaves it at the first block.
+bool ShardMatches(int fd, unsigned idx, unsigned numData,
+                  off_t dataOffset, off_t length)
+{
+    struct stat st;
+    if (fstat(fd, &st) ||
+        (st.st_size > length) ||
+        (st.st_size < dataOffset))
+    {
+        return false;
+    }
+    // one read, and they all happen at once
+    uint8_t block[TAR_BLOCK];
+    if (pread(fd, block, TAR_BLOCK, 0) != (ssize_t)TAR_BLOCK)
+    {
+        return false;
+    }
+    shardHeader hdr;
+    return UnpackHeader(block, hdr) &&
+        (hdr.fileNum == idx) &&
+        (hdr.numData == numData) &&
+        (hdr.dataOffset == dataOffset) &&
+        (lseek(fd, dataOffset, SEEK_SET) == dataOffset);
+}
 
-    // print out the D matrix
-    void print(const char * msg,
-               std::ostream & os = std::cerr)
+/*
+  Open the shards listed in STUB.shards, all at once and each at its
+  first block. false if there's no manifest (or it doesn't make
+  sense), otherwise 'fds' has the ones that opened, 'numOpen' of them,
+  and 'numBlocks' is how many each of them should have.
+*/
+bool OpenManifest(const std::string & stub, int * fds,
+                  uint8_t & numData, uint8_t & numParity,
+                  uint8_t & numGroups, uint32_t & rotate,
+                  uint8_t & compression, uint64_t & numBlocks,
+                  unsigned & numOpen)
+{
+    std::string filename = stub + ".shards";
+    FILE * file = fopen(filename.c_str(), "r");
+    if (!file)
+    {
+        return false;
+    }
+
+    unsigned version = 0, nd = 0, np = 0, ng = 0, rot = 0, comp = 0;
+    size_t   blocksize = 0;
+    unsigned long long blocks = 0;
+    unsigned numShards = 0;
+    off_t    dataOffset[250];
+    off_t    length[250];
+    char line[256];
+    while (fgets(line, sizeof(line), file))
+    {
+        unsigned idx;
+        unsigned long long off, len;
+        if ((sscanf(line, "version %u", &version) == 1) ||
+            (sscanf(line, "geometry %u %u", &nd, &np) == 2) ||
+            (sscanf(line, "groups %u", &ng) == 1) ||
+            (sscanf(line, "rotate %u", &rot) == 1) ||
+            (sscanf(line, "blocksize %zu", &blocksize) == 1) ||
+            (sscanf(line, "compression %u", &comp) == 1) ||
+            (sscanf(line, "blocks %llu", &blocks) == 1))
         {
-            print(msg, d, numData + numParity, numData, os);
+            continue;
         }
+        if ((sscanf(line, "shard %x %llu %llu", &idx, &off, &len) == 3) &&
+            (idx == numShards) && (idx < 250))
+        {
+            dataOffset[idx] = off;
+            length[idx]     = len;
+            numShards++;
+        }
+    }
+    fclose(file);
 
-    // print out a given matrix
-    static void print(const char * msg,
-                      uint8_t ** m,
-                      uint8_t rows,
-                      uint8_t cols,
-                      std::ostream & os = std::cerr)
+    if ((version != MANIFEST_VERSION) ||
+        !nd || !np || (ng > nd) || ((nd + np + ng) > 250) ||
+        (numShards != (nd + np + ng)) || !blocks ||
+        (blocksize != BLOCKSIZE) || (comp > 255))
+    {
+        std::cerr << "Ignoring " << filename << std::endl;
+        return false;
+    }
+    numData     = nd;
+    numParity   = np;
+    numGroups   = ng;
+    rotate      = rot;
+    compression = comp;
+    numBlocks   = blocks;
+
+    // open them in parallel, on a network filesystem that's the
+    // difference between one round trip and a few hundred
+    std::atomic<unsigned> next(0);
+    std::atomic<unsigned> opened(0);
+    std::vector<std::thread> openers;
+    for (unsigned t = 0; t < std::min(numShards, 32u); t++)
+    {
+        openers.push_back(std::thread([&]()
         {
-            if (!os) return;
-            os << msg << '\n';
-            for (int row = 0; row < rows; row++)
+            for (unsigned idx = next++; idx < numShards; idx = next++)
             {
-                for (int col = 0; col < cols; col++)
+                std::string name = MakeFilename(stub, idx);
+                int fd = open(name.c_str(), O_RDONLY);
+                if (fd < 0)
                 {
-                    os << '\t' << (int)m[row][col];
+                    continue;
+                }
+                if (!ShardMatches(fd, idx, nd, dataOffset[idx], length[idx]))
+                {
+                    std::cerr << name << " isn't as in " << filename
+                              << ", ignoring it" << std::endl;
+                    close(fd);
+                    continue;
                 }
-                os << '\n';
+                fds[idx] = fd;
+                opened++;
             }
-            os << std::endl;
-        }
-
-    // generate the recovery matrix
-    uint8_t ** recovery()
-        {
-// print numData+1 cols            print("Remaining", dumpFile);
+        }));
+    }
+    for (size_t t = 0; t < openers.size(); t++)
+    {
+        openers[t].join();
+    }
+    numOpen = opened;
+    return true;
+}
 
-            // create an array to hold the recovery matrix
-            uint8_t ** ret = makeArray(numData, numData + 1);
-            // create an identity matrix...
-            for (int idx = 0; idx < numData; idx++)
-            {
-                ret[idx][idx] = 1;
-            }
+// read 'in' until EOF, writing the shards to stub00, stub01, ...
+// false (with 'in' closed and nothing left behind) if they can't be
+// created.
+bool CreateParity(const gfm_codec * codec,
+                  int in,
+		  const std::string & stub)
+{
+    const uint8_t numData   = gfm_codec_data(codec);
+    const uint8_t numParity = gfm_codec_parity(codec);
+    // all of them, with any local parity
+    const int     rows      = gfm_codec_shards(codec);
+    int fds[rows];
+    shardHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SHARD_MAGIC, sizeof(hdr.magic));
+    hdr.version = SHARD_VERSION;
+    hdr.headerLen = SHARD_HEADER_LEN;
+    hdr.numData = numData;
+    hdr.numParity = numParity;
+    hdr.blocksizePo2 = BLOCKSIZE_Po2;
+    hdr.numGroups = gfm_codec_groups(codec);
+    hdr.rotate = rotateStripes;
+    const Layout layout = {rows, rotateStripes};
+    hdr.numBlobs = ((numBlobs < 0) || (numBlobs > rows))
+        ? rows
+        : numBlobs;
+
+    // opaque since OpenSSL 1.1, so keep pointers
+    EVP_MD_CTX * MD_ctx[257];
+    std::string filename[257];
 
-            // create a temporary matrix for the
-            // upcoming matrix inversion
-            uint8_t ** tmp = makeArray(numData, numData);
+    const EVP_MD * EVP_MD5 = EVP_md5();
 
-            // when replacing a failed row, start at the end of the matrix
-            uint8_t tst = numData + numParity;
-            // fill in the tmp matrix from the available rows
-            for (int row = 0; row < numData; row++)
-            {
-                // assume the row has not failed (i.e. just copy it)
-                uint8_t cpy = row;
-                // if the row has failed ...
-                if (failed(cpy))
-                {
-                    // search for a non-failed row to replace it
-                    while(failed(--tst))
-                    {
-                        // make sure we haven't run out of redundancy..
-                        assert(tst > (row + 1));
-                    }
-                    cpy = tst;
-                }
-                // copy the row
-                memcpy(tmp[row], d[cpy], numData * sizeof(uint8_t));
-                ret[row][numData] = cpy;
-            }
+    MD_ctx[256] = EVP_MD_CTX_new();
+    attest(MD_ctx[256], "Unable to create MD context");
+    EVP_DigestInit_ex(MD_ctx[256], EVP_MD5, 0);
+    filename[256] = stub + ".md5";
+    FILE * md5File = fopen(filename[256].c_str(), "w");
+    if (!md5File)
+    {
+        fprintf(stderr, "Unable to open MD file: '%s': %m\n",
+                filename[256].c_str());
+        EVP_MD_CTX_free(MD_ctx[256]);
+        close(in);
+        return false;
+    }
 
-            print("Recovery", tmp, numData, numData, dumpFile);
+    // for the .shards manifest
+    uint32_t dataOffset[rows];
+    uint64_t numStripes = 0;
 
-            // OK.... now I have to do a gaussian elimination on the tmp matrix
+    // --zstd: the shards say so
+    hdr.compression = useZstd ? SHARD_ZSTD : SHARD_PLAIN;
 
-            // first reduce it to major column order
-            for (int col = 0; col < numData-1; col++)
+    for (int idx = 0; idx < rows; idx++)
+    {
+        filename[idx] = MakeFilename(stub, idx);
+        fds[idx] = open(filename[idx].c_str(),
+                        O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fds[idx] < 0)
+        {
+            fprintf(stderr, "Unable to open file: '%s': %m\n",
+                    filename[idx].c_str());
+            // none of it, rather than some
+            for (int made = 0; made < idx; made++)
             {
-                attest(tmp[col][col],
-                       "zero in major diagonal[%d] of reduced", col);
-                uint8_t ref = tmp[col][col];
-                for (int row = col+1; row < numData; row++)
-                {
-                    uint8_t val = tmp[row][col];
-                    // if this field is already zero then skip to the next one
-                    if (!val) continue;
-                    //	    DMP((int)val);
-                    uint8_t mult = gfa.div(ref, val);
-                    //tmp[row] *= mult
-                    MulyRowBy(tmp, row, mult);
-                    MulyRowBy(ret, row, mult);
-                    //tmp[row] += tmp[col]
-                    AddRow(tmp, row, col);
-                    AddRow(ret, row, col);
-                }
+                close(fds[made]);
+                unlink(filename[made].c_str());
+                EVP_MD_CTX_free(MD_ctx[made]);
             }
+            fclose(md5File);
+            unlink(filename[256].c_str());
+            EVP_MD_CTX_free(MD_ctx[256]);
+            close(in);
+            return false;
+        }
 
-            print("MCO", ret, numData, numData+1, dumpFile);
+        MD_ctx[idx] = EVP_MD_CTX_new();
+        attest(MD_ctx[idx], "Unable to create MD context");
+        EVP_DigestInit_ex(MD_ctx[idx], EVP_MD5, 0);
 
-            // next... we'll reduce the upper triangle
-            for (int col = 1; col < numData; col++)
-            {
-                attest(tmp[col][col],
-                       "zero in major diagonal[%d] of MCO", col);
-                uint8_t ref = tmp[col][col];
-                for (int row = 0; row < col; row++)
-                {
-                    uint8_t val = tmp[row][col];
-                    // if this field is already zero then skip to the next one
-                    if (!val) continue;
-                    //	    DMP((int)val);
-                    uint8_t mult = gfa.div(ref, val);
-                    //tmp[row] *= mult
-                    MulyRowBy(tmp, row, mult);
-                    MulyRowBy(ret, row, mult);
-                    //tmp[row] += tmp[col]
-                    AddRow(tmp, row, col);
-                    AddRow(ret, row, col);
-                }
-            }
+        hdr.fileNum = idx;
+        hdr.blobLen = (idx < hdr.numBlobs) ? _binary_gfm_tar_len : 0;
+        // on a block boundary, after the tarball if there is one
+        hdr.dataOffset = (std::max(TAR_BLOCK, (size_t)hdr.blobLen)
+                          + BLOCKSIZE - 1) & ~(BLOCKSIZE - 1);
+        writeHeader(fds[idx], hdr, MD_ctx[idx]);
+        dataOffset[idx] = hdr.dataOffset;
 
-            print("UT", ret, numData, numData, dumpFile);
+    }
 
-            // now normalise
-            for (int idx = 0; idx < numData; idx++)
-            {
-                uint8_t mult = gfa.div(1,tmp[idx][idx]);
-                MulyRowBy(tmp, idx, mult);
-                MulyRowBy(ret, idx, mult);
-            }
+    // --zstd: compress it on the way in, the digest is of what came in
+    ZStage * zstd = 0;
+    if (useZstd)
+    {
+        int p[2];
+        attest(!pipe(p), "Unable to create pipe: %m");
+        zstd = new ZStage(true, in, p[1], zstdLevel, zstdThreads,
+                          MD_ctx[256]);
+        // readFully() closes it at the end
+        in = p[0];
+    }
 
-            print("Norm", ret, numData, numData, dumpFile);
+    StripePool * pool = MakePool(rows);
+    StageQueue<Stripe> toCompute;
+    StageQueue<Stripe> toWrite;
 
-            // OK.... now if we got that right then
-            // tmp * ret = ret * tmp = I (mostly)
-            // for failed rows, all bets are off
-            for (int row = 0; row < numData; row++)
+    // read the input a stripe at a time
+    std::thread reader([&]()
+    {
+        IoNear(in);
+        for (uint64_t stripe = 0; ; stripe++)
+        {
+            uint8_t ** buff = pool->Get();
+            PROBE2(stripe_start, stripe, numData * BLOCKSIZE);
+            uint64_t t = stats.start();
+            memset(buff[0], 0, numData * BLOCKSIZE);
+            ssize_t numRead = readFully(in, buff[0], (numData * BLOCKSIZE) - 1,
+                                        zstd);
+            attest(numRead >= 0, "Unable to read input: %m");
+            stats.stop(Stats::READ, t, numRead);
+            // --zstd read (and paid for) the input itself
+            if (!zstd)
             {
-                bool f = failed(row);
-                for (int col = 0; col < numData; col++)
-                {
-                    uint8_t a = 0;
-                    uint8_t b = 0;
-                    for (int i = 0; i < numData; i++)
-                    {
-                        a ^= gfa.mult(tmp[row][i], ret[i][col]);
-                        b ^= gfa.mult(ret[row][i], tmp[i][col]);
-                    }
-                    // assert((tmp * ret) == (ret * tmp))
-                    assert(a == b);
-                    // non-failed rows must be from the identity matrix
-                    // failed rows must be fully populated
-                    //a = ret[row][col];
-//                    assert(f ? a : (a == (row == col) ? 1 : 0));
-                    assert(f || (a == (row == col) ? 1 : 0));
-                }
+                throttle.Read(numRead);
             }
-            // get rid of the temp matrix and return the recovery one
-            free(tmp);
-            return ret;
-        }
 
-    // recover a block of data
-    inline void recover(uint8_t ** data, uint8_t ** r, size_t len)
-        {
-            for (uint8_t row = 0; row < numData; row++)
+            Stripe s = {buff, stripe, numRead, 0, false};
+            toCompute.Push(s);
+            // done?
+            if (numRead != (ssize_t)((numData * BLOCKSIZE)-1))
             {
-                // if this row is available ...
-                if (r[row][numData] == row)
-                {
-                    // noting else to do
-                    continue;
-                }
-                // nuke whatever junk there may be
-                memset(data[row], 0, len);
-                for (uint8_t col = 0; col < numData; col++)
-                {
-                    // row and col are constant now, I'm
-                    // hoping the compiler is smart enough
-                    // to optimise the following:
-                    for (size_t idx = 0; idx < len; idx++)
-                    {
-                        data[row][idx] ^= gfa.mult(r[row][col],
-                                                   data[r[col][numData]][idx]);
-                    }
-                }
+                break;
             }
         }
+        Stripe end = {0, 0, 0, 0, false};
+        toCompute.Push(end);
+    });
 
-    // recover a single dataset
-    inline void recover(uint8_t * data, uint8_t ** r)
+    // write the shards, then the buffer can be re-used
+    std::thread writer([&]()
+    {
+        IoNear(fds[0]);
+        static const uint8_t zeros[BLOCKSIZE] = {0,};
+        for (Stripe s = toWrite.Pop(); s.buff; s = toWrite.Pop())
         {
-            for (uint8_t row = 0; row < numData; row++)
+            for (int idx = 0; idx < rows; idx++)
             {
-                uint8_t tmp = 0;
-                for (uint8_t col = 0; col < numData; col++)
+                const uint8_t * block = s.buff[layout.row(idx, s.index)];
+                uint64_t t = stats.start();
+                PROBE3(shard_write_start, s.index, idx, BLOCKSIZE);
+                // a block of zeros is skipped over, leaving a hole (the
+                // last stripe never is, it has the padding)
+                const bool hole = s.zero ||
+                    gfm_is_zero(codec, block, BLOCKSIZE);
+                ssize_t numWritten;
+                if (hole)
                 {
-                    tmp ^= gfa.mult(r[row][col],
-                                    data[r[col][numData]]);
+                    numWritten = (lseek(fds[idx], BLOCKSIZE, SEEK_CUR) < 0)
+                        ? -1
+                        : BLOCKSIZE;
                 }
-                data[row] = tmp;
+                else
+                {
+                    IoSlot io;
+                    const uint64_t w = throttle.start();
+                    numWritten = write(fds[idx], block, BLOCKSIZE);
+                    throttle.Write(BLOCKSIZE, w, idx);
+                }
+                PROBE3(shard_write_done, s.index, idx, numWritten);
+                attest(numWritten == (ssize_t)BLOCKSIZE,
+                       "Unable to write block: '%s'",
+                       filename[idx].c_str());
+                stats.syscall(Stats::WRITE);
+                stats.stop(Stats::WRITE, t, hole ? 0 : BLOCKSIZE);
+
+                // the digest is of the zeros all the same
+                t = stats.start();
+                EVP_DigestUpdate(MD_ctx[idx], hole ? zeros : block, BLOCKSIZE);
+                stats.stop(Stats::DIGEST, t, BLOCKSIZE);
             }
+            stats.stripe(s.numRead);
+            PROBE2(stripe_end, s.index, s.numRead);
+            pool->Put(s.buff);
+            numStripes++;
         }
+    });
 
-    // helper function for recovery matrix creation
-    void MulyRowBy(uint8_t ** m, uint8_t row, uint8_t mult)
+    // calc parity, in between
+    for (Stripe s = toCompute.Pop(); s.buff; s = toCompute.Pop())
+    {
+        uint64_t t = stats.start();
+        gfm_pad(s.buff[0], s.numRead, numData * BLOCKSIZE);
+        // nothing but zeros, and so is the parity
+        s.zero = gfm_is_zero(codec, s.buff[0], numData * BLOCKSIZE);
+        if (!s.zero)
         {
-            // cheating!! dim should be passed in!!
-            for (int col = 0; col < numData; col++)
-            {
-                m[row][col] = gfa.mult(m[row][col], mult);
-            }
+            gfm_encode(codec, s.buff, BLOCKSIZE);
         }
+        stats.stop(Stats::PARITY, t, numData * BLOCKSIZE);
+        PROBE2(parity_done, s.index, numData * BLOCKSIZE);
 
-    // a += b
-    void AddRow(uint8_t ** m, uint8_t a, uint8_t b)
+        if (!zstd)
         {
-            for (int col = 0; col < numData; col++)
-            {
-                m[a][col] ^= m[b][col];
-            }
+            t = stats.start();
+            EVP_DigestUpdate(MD_ctx[256], s.buff[0], s.numRead);
+            stats.stop(Stats::DIGEST, t, s.numRead);
         }
 
-private:
-    GFA        gfa;
-    uint8_t ** d;
-    uint8_t numData;
-    uint8_t numParity;
-
-
-public:
-    // built-in test
-    static void BIT()
-        {
-            // test 25 data blocks (64K each) with 25 parity blocks
-            const uint8_t numData   = 25;
-            const uint8_t numParity = 25;
-            const size_t blockSize  = 64 * 1024;
-
-            GFM gfm(numData, numParity);
-
-            // run the GFA built-in-test
-            gfm.gfa.BIT();
-
-            // single row test (redundant?)
-            uint8_t data[(numData+numParity)] = {55, 42, 69};
+        toWrite.Push(s);
+    }
+    Stripe end = {0, 0, 0, 0, false};
+    toWrite.Push(end);
+    reader.join();
+    writer.join();
 
-            // matrix test
-            uint8_t ** data2 = gfm.makeArray(numData + numParity, blockSize);
-            // fill the matrix with deterministic junk
-            for (uint8_t rowIdx = 0; rowIdx < numData; rowIdx++)
-            {
-                uint8_t * row = data2[rowIdx];
-                for (size_t idx = 0; idx < blockSize; idx++)
-                {
-                    row[idx] = (uint8_t)(idx * (rowIdx^idx));
-                }
-            }
+    // finish off all the files, out to the end of any trailing hole
+    for (int idx = 0; idx < rows; idx++)
+    {
+        off_t end = lseek(fds[idx], 0, SEEK_CUR);
+        attest((end >= 0) && !ftruncate(fds[idx], end),
+               "Unable to extend '%s': %m", filename[idx].c_str());
+        close(fds[idx]);
+        PrintMD(md5File, filename[idx], MD_ctx[idx]);
+    }
 
-            // generate the parity data
-            gfm.parity(data);
-            gfm.parity(data2, blockSize);
-
-            // fail a bunch of rows
-#define FAIL_DATA(x) {gfm.failData(x); data[x] = -2;}
-            FAIL_DATA(9);
-            FAIL_DATA(1);
-            FAIL_DATA(2);
-            FAIL_DATA(3);
-            FAIL_DATA(4);
-            FAIL_DATA(5);
-            FAIL_DATA(6);
-            FAIL_DATA(7);
-#undef FAIL_DATA
-
-            // generate a recovery matrix
-            uint8_t ** r = gfm.recovery();
-
-            // recover ...
-            gfm.recover(data, r);
-            gfm.recover(data2, r, blockSize);
-
-            // test the junk
-            for (uint8_t rowIdx = 0; rowIdx < numData; rowIdx++)
-            {
-                uint8_t * row = data2[rowIdx];
-                for (size_t idx = 0; idx < blockSize; idx++)
-                {
-                    assert(row[idx] == (uint8_t)(idx * (rowIdx^idx)));
-                }
-            }
+    // it's done with MD_ctx[256] once it's all been read
+    delete zstd;
+    PrintMD(md5File, "-", MD_ctx[256]);
 
-            free(r);
-            free(data2);
-        };
-};
+    fclose(md5File);
 
-std::string MakeFilename(const std::string & stub, int num)
-{
-    std::ostringstream o;
-    o << (stub);
-    o << std::setw(2) << std::setfill('0') << std::hex << num;
+    WriteManifest(stub, hdr, dataOffset, numStripes);
 
-    return o.str();
+    delete pool;
+    return true;
 }
 
-void writeHeader(int fd, const signature & sig, EVP_MD_CTX & ctx)
-{
-    attest(write(fd,&_binary_gfm_tar_start,
-                 _binary_gfm_tar_len) == (ssize_t)_binary_gfm_tar_len,
-           "Unable to write tarball");
-    EVP_DigestUpdate(&ctx, &_binary_gfm_tar_start,
-               _binary_gfm_tar_len);
-
-    attest(write(fd,&sig, sizeof(sig))
-           == (ssize_t)sizeof(sig),
-           "Unable to write signature");
-    EVP_DigestUpdate(&ctx, &sig, sizeof(sig));
-
-    static ssize_t len = 0;
-    static char  * pad = 0;
-    if (!pad)
-    {
-        len = _binary_gfm_tar_len + sizeof(sig) + BLOCKSIZE - 1;
-        //DMP(_binary_gfm_tar_len);
-        //DMP(sizeof(sig));
-        //DMP(BLOCKSIZE);
-        len &= ~(BLOCKSIZE - 1);
-        len -= _binary_gfm_tar_len + sizeof(sig);
-        //DMP(len + _binary_gfm_tar_len + sizeof(sig));
-        //DMPX(len + _binary_gfm_tar_len + sizeof(sig));
-        //DMP(len);
-        pad = (char*)calloc(len,1);
-        attest(pad, "unable to calloc pad");
-    }
-    attest(write(fd,pad, len) == len,
-           "Unable to write pad");
-    EVP_DigestUpdate(&ctx, pad, len);
-}
 
-ssize_t readFully(int fd, void * buff, ssize_t len)
+// open a shard and check it's the one in 'sig' (numData of 255 for
+// don't know yet), left at the first block. 0 if it isn't.
+// The rest of its header goes in 'info' (if not 0), made up for
+// an old shard.
+int OpenFile(const std::string & filename,
+	     signature & sig,
+             shardHeader * info = 0)
 {
-    // previously read
-    ssize_t prev = 0;
-    // number of bytes read this (first) time
-    ssize_t rc = read(fd, buff, len);
-    while(rc > 0)
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
     {
-        if ((rc + prev) == len)
-	{
-            // read it all, bye!
-            return len;
-	}
-        prev += rc;
-        rc = read(fd, ((char*)buff) + prev, len - prev);
+        return 0;
     }
-    // EOF or some other error, close the file!
-    close(fd);
-    return (rc < 0) ? rc : prev;
-}
 
-void addPadding(uint8_t * buff, ssize_t numRead, ssize_t expected)
-{
-    // is the buffer full?
-    if (numRead == expected)
+    uint8_t block[TAR_BLOCK];
+    ssize_t rc = pread(fd, block, TAR_BLOCK, 0);
+    if (rc != (ssize_t)TAR_BLOCK)
     {
-        // no need to add padding!
-        buff[expected] = 0;
-        return;
+        close(fd);
+        return 0;
     }
-    // how many bytes are missing?
-    ssize_t missing = (expected - numRead);
-    // sanity check.....
-    assert(missing > 0);
 
-    // flag the block as being short
-    // missing fewer than 0x80 (128) bytes?
-    if (missing < 0x80)
+    signature chk;
+    off_t off = 0;
+    shardHeader hdr;
+    if (!memcmp(block + SHARD_HEADER_AT, SHARD_MAGIC, sizeof(SHARD_MAGIC)))
     {
-        // just use the last byte to store the shortfall
-        buff[expected] = (uint8_t)(missing & 0xFF);
-        return;
+        attest(UnpackHeader(block, hdr),
+               "bad shard header in '%s'", filename.c_str());
+        chk.numData      = hdr.numData;
+        chk.numParity    = hdr.numParity;
+        chk.fileNum      = hdr.fileNum;
+        chk.blocksizePo2 = hdr.blocksizePo2;
+        off = hdr.dataOffset;
     }
-    // use a 32-bit int to store the shortfall
-    buff[expected--] = 0x80;
-    uint32_t * buff32 = (uint32_t *)buff;
-    buff32[(expected/4)-2] = missing;
-}
-
-size_t removePadding(uint8_t * buff, size_t buffSize)
-{
-    uint8_t flag = buff[--buffSize];
-    // block full?
-    if (flag == 0)
+    else
     {
-        // no padding to remove
-//        DMP(buffSize);
-        return buffSize;
+        memset(&hdr, 0, sizeof(hdr));
+        // an old one, the signature is after the tarball (if any)
+        if (isTarHeader(block))
+        {
+            char size[12];
+            memcpy(size, block + 124, 11);
+            size[11] = '\0';
+            char * endptr = 0;
+            off = strtol(size, &endptr, 8);
+            attest(endptr && (*endptr == '\0'),
+                   "unable to decode file size from tar header");
+            off += TAR_BLOCK;
+        }
+        rc = pread(fd, &chk, sizeof(chk), off);
+        attest((rc == sizeof(chk)),
+               "unable to read signature block");
+        // the first block starts on the next BLOCKSIZE boundary
+        off += sizeof(signature) + BLOCKSIZE - 1;
+        off &= ~(BLOCKSIZE - 1);
     }
 
-    // block missing < 128 bytes?
-    if (flag < 0x80)
+    // might not know numData yet either...
+    if (sig.numData == 255)
     {
-//        DMP(buffSize - flag);
-        return buffSize - flag;
+        sig.numData   = chk.numData;
+        sig.numParity = chk.numParity;
+    }
+    else
+    {
+        // numParity not known at this stage, so cheat
+        chk.numParity = sig.numParity;
+    }
+    // check that
+    if (memcmp(&sig, &chk, sizeof(sig)))
+    {
+        close(fd);
+        return 0;
     }
 
-    // missing lots!
-    uint32_t * buff32 = (uint32_t *)buff;
-    uint32_t missing = buff32[(buffSize/4)-2];
-    buffSize -= missing;
-//    DMP(missing);
-//    DMP(buffSize);
-    return buffSize;
-}
-
-std::string StripDir(const std::string & filename)
-{
-    size_t found = filename.find_last_of("/\\");
-    // make sure fn doesn't get gc'ed which fn.c_str is in use!
-    return filename.substr(found+1);
-}
-
-// print out the MD checksums
-void PrintMD(FILE * file,
-	     const std::string & filename,
-	     EVP_MD_CTX & ctx)
-{
-    unsigned char digest[EVP_MAX_MD_SIZE];
-    unsigned int  digestLen = sizeof(digest);
-    EVP_DigestFinal_ex(&ctx, digest, &digestLen);
+    attest((lseek(fd, off, SEEK_SET) == off),
+           "unable to seek to the first block (0x%x): %m", off);
 
-    unsigned i;
-    for (i = 0; i < digestLen; i++)
+    if (info)
     {
-        fprintf(file, "%02x", (digest[i] & 0xFF));
+        *info = hdr;
+        info->numData      = chk.numData;
+        info->numParity    = chk.numParity;
+        info->fileNum      = chk.fileNum;
+        info->blocksizePo2 = chk.blocksizePo2;
+        info->dataOffset   = off;
     }
-    // make sure fn doesn't get gc'ed which fn.c_str is in use!
-    std::string fn = StripDir(filename);
-    fprintf(file, "  %s\n", fn.c_str());
-
-    EVP_MD_CTX_cleanup(&ctx);
+    return fd;
 }
 
-void CreateParity(const uint8_t numData,
-		  const uint8_t numParity,
-		  const std::string & stub)
+// Only the last stripe is padded, and its padding flag is never 0
+// (a stream a multiple of the stripe long gets an empty one). So a
+// decoded 'stripe' whose flag says otherwise is either where all the
+// shards were cut short or not the stripe it should be.
+void CheckPadding(const uint8_t * stripe, uint8_t numData,
+                  uint64_t index, bool last)
 {
-    GFM gfm (numData, numParity);
-    int fds[numParity + numData];
-    signature sig;
-    sig.numData = numData;
-    sig.numParity = numParity;
-    //  sig.fileNum = 0;;
-    sig.blocksizePo2 = BLOCKSIZE_Po2;
+    const uint8_t flag = stripe[(numData * BLOCKSIZE) - 1];
+    attest(!last || flag,
+           "The shards end at stripe %llu, before the end of the data",
+           (unsigned long long)index);
+    attest(last || !flag, "Stripe %llu is damaged, unable to recover",
+           (unsigned long long)index);
+}
 
-    EVP_MD_CTX MD_ctx[257];
-    std::string filename[257];
+// the (cached) decoder for a set of erased shards, 0 if the rest
+// aren't enough
+typedef std::function<const gfm_decoder * (const std::vector<uint8_t> &)> DecoderFor;
 
-    const EVP_MD * EVP_MD5 = EVP_md5();
+// one stripe as the --hedge readers fill it in
+struct HedgeSlot
+{
+    std::mutex              mutex;
+    std::condition_variable cond;
+    // UINT64_MAX until the first stripe is put in it
+    uint64_t    stripe;
+    uint8_t  ** buff;
+    // the rows that made it in time
+    std::vector<uint8_t> have;
+    ssize_t     numRead;
+    // readers done with it, one way or another
+    int         passed;
+    // enough to decode it with rcvr
+    bool        done;
+    const gfm_decoder * rcvr;
+};
 
-    EVP_MD_CTX_init(&MD_ctx[256]);
-    EVP_DigestInit_ex(&MD_ctx[256], EVP_MD5, 0);
-    filename[256] = stub + ".md5";
-    FILE * md5File = fopen(filename[256].c_str(), "w");
-    attest(md5File, "Unable to open MD file: '%s'",
-           filename[256].c_str());
+/**
+   --hedge: each of the shards being read has a thread of its own,
+   and each stripe is decoded from the first of them to turn up with
+   a block for it, so a slow disk or two doesn't hold everything up.
+   A reader that's fallen behind skips the stripes that are done
+   without it. The stripes are handed on in order, in a ring of one
+   slot per buffer in the pool.
+*/
+void HedgedReads(const gfm_codec * codec,
+                 const Layout & layout,
+                 int * fds,
+                 const off_t * start,
+                 uint64_t numStripes,
+                 StripePool * pool,
+                 StageQueue<Stripe> & toCompute,
+                 const DecoderFor & decoderFor)
+{
+    const int rows    = gfm_codec_shards(codec);
+    const int numData = gfm_codec_data(codec);
 
-    for (int idx = 0; idx < (numData + numParity); idx++)
+    // the first numData + hedgeExtra shards there are, the rest
+    // stand in for any of them that end early
+    std::vector<int> shards;
+    for (int idx = 0; idx < rows; idx++)
     {
-        filename[idx] = MakeFilename(stub, idx);
-        fds[idx] = open(filename[idx].c_str(),
-                        O_WRONLY | O_CREAT | O_TRUNC, 0644);
-        attest(fds[idx], "Unable to open file: '%s'",
-               filename[idx].c_str());
-
-        EVP_MD_CTX_init(&MD_ctx[idx]);
-        EVP_DigestInit_ex(&MD_ctx[idx], EVP_MD5, 0);
-
-        sig.fileNum = idx;
-        writeHeader(fds[idx], sig, MD_ctx[idx]);
-
+        if (fds[idx]) shards.push_back(idx);
     }
+    const int numReaders = std::min<int>(shards.size(), numData + hedgeExtra);
+    std::atomic<size_t> nextSpare(numReaders);
 
-    uint8_t ** buff = GFM::makeArray(numData + numParity, BLOCKSIZE);
+    std::vector<std::unique_ptr<HedgeSlot> > slots(pool->size());
+    for (size_t s = 0; s < slots.size(); s++)
+    {
+        slots[s].reset(new HedgeSlot);
+        slots[s]->stripe = UINT64_MAX;
+    }
 
-    while(1)
+    std::vector<std::thread> threads;
+    for (int r = 0; r < numReaders; r++)
     {
-        memset(buff[0], 0, numData * BLOCKSIZE);
-        ssize_t numRead = readFully(0, buff[0], (numData * BLOCKSIZE) - 1);
-        addPadding(buff[0], numRead, (numData * BLOCKSIZE) - 1);
-        // calc parity
-        gfm.parity(buff, BLOCKSIZE);
+        threads.push_back(std::thread([&, r]()
+        {
+            int idx = shards[r];
+            std::vector<uint8_t> block(BLOCKSIZE);
+            bool dead = false;
+            for (uint64_t stripe = 0; stripe < numStripes; stripe++)
+            {
+                HedgeSlot & slot = *slots[stripe % slots.size()];
+                {
+                    std::unique_lock<std::mutex> lock(slot.mutex);
+                    slot.cond.wait(lock, [&]()
+                    {
+                        return (slot.stripe != UINT64_MAX) && (slot.stripe >= stripe);
+                    });
+                    // long gone, or done without this one
+                    if ((slot.stripe != stripe) || slot.done || dead)
+                    {
+                        if (slot.stripe == stripe) slot.passed++;
+                        attest(slot.done || (slot.passed < numReaders),
+                               "Too many shards missing from stripe %llu on",
+                               (unsigned long long)stripe);
+                        continue;
+                    }
+                }
+
+                ssize_t got = 0;
+                while (!dead && (got != (ssize_t)BLOCKSIZE))
+                {
+                    PROBE3(shard_read_start, stripe, idx, BLOCKSIZE);
+                    uint64_t t = stats.start();
+                    got = ShardRead(fds[idx], idx, block.data(), BLOCKSIZE,
+                                    start[idx] + (stripe * BLOCKSIZE));
+                    stats.stop(Stats::READ, t, std::max<ssize_t>(got, 0));
+                    stats.syscall(Stats::READ, got < (ssize_t)BLOCKSIZE);
+                    PROBE3(shard_read_done, stripe, idx, got);
+                    if (got != (ssize_t)BLOCKSIZE)
+                    {
+                        std::cerr << "Shard " << idx << " ends at stripe "
+                                  << stripe << ", recovering without it"
+                                  << std::endl;
+                        // a spare takes over from here, if there is one
+                        size_t spare = nextSpare++;
+                        dead = (spare >= shards.size());
+                        if (!dead) idx = shards[spare];
+                    }
+                }
 
-        EVP_DigestUpdate(&MD_ctx[256], buff[0], numRead);
+                std::lock_guard<std::mutex> lock(slot.mutex);
+                // done and written while this was being read, the slot
+                // may even be on to another stripe by now
+                if ((slot.stripe != stripe) || slot.done)
+                {
+                    stats.late(idx);
+                    continue;
+                }
+                slot.passed++;
+                if (!dead)
+                {
+                    const int row = layout.row(idx, stripe);
+                    memcpy(slot.buff[row], block.data(), BLOCKSIZE);
+                    slot.have[row] = 1;
+                    slot.numRead += got;
+                    // enough yet?
+                    if (std::count(slot.have.begin(), slot.have.end(), 1) >= numData)
+                    {
+                        std::vector<uint8_t> erased(rows);
+                        for (int i = 0; i < rows; i++)
+                        {
+                            erased[i] = !slot.have[i];
+                        }
+                        slot.rcvr = decoderFor(erased);
+                        slot.done = slot.rcvr;
+                    }
+                }
+                attest(slot.done || (slot.passed < numReaders),
+                       "Too many shards missing from stripe %llu on",
+                       (unsigned long long)stripe);
+                if (slot.done)
+                {
+                    slot.cond.notify_all();
+                }
+            }
+        }));
+    }
 
+    // hand them on as they're done, in order
+    std::thread collector([&]()
+    {
+        for (uint64_t stripe = 0; stripe < numStripes; stripe++)
+        {
+            HedgeSlot & slot = *slots[stripe % slots.size()];
+            std::unique_lock<std::mutex> lock(slot.mutex);
+            slot.cond.wait(lock, [&]()
+            {
+                return (slot.stripe == stripe) && slot.done;
+            });
+            Stripe s = {slot.buff, stripe, slot.numRead, slot.rcvr, false};
+            toCompute.Push(s);
+        }
+    });
 
-        // write data/parity
-        for (int idx = 0; idx < (numData + numParity); idx++)
-	{
-            ssize_t numWritten = write(fds[idx], buff[idx], BLOCKSIZE);
-            attest(numWritten == (ssize_t)BLOCKSIZE,
-                   "Unable to write block: '%s'",
-                   filename[idx].c_str());
+    // put each stripe in its slot as a buffer comes free. That's once
+    // the one a ring ago has been written, so nobody is still on it.
+    for (uint64_t stripe = 0; stripe < numStripes; stripe++)
+    {
+        uint8_t ** buff = pool->Get();
+        PROBE2(stripe_start, stripe, numData * BLOCKSIZE);
+        memset(buff[0], 0, rows * BLOCKSIZE);
 
-            EVP_DigestUpdate(&MD_ctx[idx], buff[idx], BLOCKSIZE);
-	}
-        // done?
-        if (numRead != (ssize_t)((numData * BLOCKSIZE)-1))
-	{
-            break;
-	}
+        HedgeSlot & slot = *slots[stripe % slots.size()];
+        {
+            std::lock_guard<std::mutex> lock(slot.mutex);
+            slot.stripe  = stripe;
+            slot.buff    = buff;
+            slot.have.assign(rows, 0);
+            slot.numRead = 0;
+            slot.passed  = 0;
+            slot.done    = false;
+            slot.rcvr    = 0;
+        }
+        slot.cond.notify_all();
     }
 
-    // finish off all the files
-    for (int idx = 0; idx < (numData + numParity); idx++)
+    collector.join();
+    for (size_t r = 0; r < threads.size(); r++)
     {
-        close(fds[idx]);
-        PrintMD(md5File, filename[idx], MD_ctx[idx]);
+        threads[r].join();
     }
-
-    PrintMD(md5File, "-", MD_ctx[256]);
-
-    fclose(md5File);
-
-    free(buff);
 }
 
-
-int OpenFile(const std::string & filename,
-	     signature & sig)
+void RecoverData(const uint8_t numData,
+		 const gfm_codec * codec,
+                 uint32_t rotate,
+		 int * fds,
+                 uint64_t numStripes,
+                 int out,
+                 Verifier * verify = 0)
 {
-    int fd = open(filename.c_str(), O_RDONLY);
-    if (fd < 0)
+    const int rows = gfm_codec_shards(codec);
+    const Layout layout = {rows, rotate};
+    StripePool * pool = MakePool(rows);
+    StageQueue<Stripe> toCompute;
+    StageQueue<Stripe> toWrite;
+
+    // The decoder says which shards to read, numData of them or with
+    // --lrc maybe fewer, the rest are spares. A shard that ends early
+    // is erased from that stripe on and whatever the new decoder wants
+    // instead is read. One decoder per erasure pattern, i.e. not many,
+    // and they live until the end as stripes still in the pipeline
+    // may use them.
+    std::vector<uint8_t> lost(rows, 1);
+    off_t start[rows];
+    const bool known = numStripes;
+    for (int idx = 0; idx < rows; idx++)
     {
-        return 0;
+        if (!fds[idx]) continue;
+        lost[idx] = 0;
+        // OpenFile() left it at the first block
+        start[idx] = lseek(fds[idx], 0, SEEK_CUR);
+        // unless the manifest says, the longest. Any shorter ones
+        // have been cut short.
+        struct stat st;
+        if (!known && !fstat(fds[idx], &st) && (st.st_size > start[idx]))
+        {
+            numStripes = std::max<uint64_t>(numStripes,
+                                            (st.st_size - start[idx]) / BLOCKSIZE);
+        }
     }
+    attest(numStripes, "The shards end before the first stripe");
+    std::map<std::vector<uint8_t>, gfm_decoder *> decoders;
+    std::mutex decodersMutex;
+    // 0 (remembered as such) if the shards left aren't enough
+    auto tryDecoder = [&](const std::vector<uint8_t> & e)
+    {
+        std::lock_guard<std::mutex> lock(decodersMutex);
+        auto found = decoders.find(e);
+        if (found != decoders.end())
+        {
+            return (const gfm_decoder *)found->second;
+        }
+        gfm_decoder * rcvr = 0;
+        if (gfm_decoder_create(codec, e.data(), &rcvr) != GFM_OK)
+        {
+            rcvr = 0;
+        }
+        decoders[e] = rcvr;
+        return (const gfm_decoder *)rcvr;
+    };
+    auto decoderFor = [&](const std::vector<uint8_t> & e)
+    {
+        const gfm_decoder * rcvr = tryDecoder(e);
+        attest(rcvr, "Too many shards missing");
+        return rcvr;
+    };
+    // the rows the lost shards had in 'stripe'
+    auto erasedIn = [&](uint64_t stripe)
+    {
+        std::vector<uint8_t> e(rows);
+        for (int row = 0; row < rows; row++)
+        {
+            e[row] = lost[layout.shard(row, stripe)];
+        }
+        return e;
+    };
+    const gfm_decoder * rcvr = decoderFor(erasedIn(0));
 
-    off_t off = lseek(fd, 124, SEEK_SET);
-    attest((off == 124),
-           "unable to seek to file size in tar header");
+    // for the progress ETA
+    stats.Expect(numStripes * numData * BLOCKSIZE);
+
+    // --verify: the stripes go back to the pool once it's done with them
+    if (verify)
+    {
+        verify->Start(fds, start, [pool](uint8_t ** buff) { pool->Put(buff); });
+    }
 
-    char buff[12];
-    ssize_t rc = read(fd, buff, 11);
-    attest((rc == (ssize_t)11),
-           "unable to read file size from tar header");
-    buff[11] = '\0';
+    // read a block from each of the shards the decoder needs
+    std::thread reader([&]()
+    {
+        // go by the first shard, they're likely all behind one HBA
+        for (int idx = 0; idx < rows; idx++)
+        {
+            if (fds[idx])
+            {
+                IoNear(fds[idx]);
+                break;
+            }
+        }
+        if (hedgeExtra >= 0)
+        {
+            HedgedReads(codec, layout, fds, start, numStripes, pool,
+                        toCompute, tryDecoder);
+        }
+        else
+        {
+            for (uint64_t stripe = 0; stripe < numStripes; stripe++)
+            {
+                // --rotate: on to the next arrangement
+                if (layout.every && !(stripe % layout.every))
+                {
+                    rcvr = decoderFor(erasedIn(stripe));
+                }
+                uint8_t ** buff = pool->Get();
+                PROBE2(stripe_start, stripe, numData * BLOCKSIZE);
+                memset(buff[0], 0, rows * BLOCKSIZE);
+
+                ssize_t numRead = 0;
+                // read already this stripe, in case the decoder changes
+                std::vector<uint8_t> have(rows, 0);
+                // nothing but holes, so nothing to decode
+                bool zero = true;
+
+                uint64_t t = stats.start();
+                // again with another decoder if one came up short
+                for (bool retry = true; retry; )
+                {
+                    retry = false;
+                    uint8_t needed[rows];
+                    gfm_decoder_needs(rcvr, needed);
+                    for (int row = 0; row < rows; row++)
+                    {
+                        if (!needed[row] || have[row]) continue;
+                        const int idx = layout.shard(row, stripe);
+                        PROBE3(shard_read_start, stripe, idx, BLOCKSIZE);
+                        bool hole = false;
+                        ssize_t got = ShardRead(fds[idx], idx, buff[row], BLOCKSIZE,
+                                                start[idx] + (stripe * BLOCKSIZE),
+                                                &hole);
+                        PROBE3(shard_read_done, stripe, idx, got);
+                        stats.syscall(Stats::READ, got < (ssize_t)BLOCKSIZE);
+                        if (got != (ssize_t)BLOCKSIZE)
+                        {
+                            std::cerr << "Shard " << idx << " ends at stripe "
+                                      << stripe << ", recovering without it"
+                                      << std::endl;
+                            close(fds[idx]);
+                            fds[idx]  = 0;
+                            lost[idx] = 1;
+                            rcvr  = decoderFor(erasedIn(stripe));
+                            retry = true;
+                            break;
+                        }
+                        have[row] = 1;
+                        zero = zero && hole;
+                        numRead += got;
+                    }
+                }
+                stats.stop(Stats::READ, t, numRead);
 
-    char * endptr = 0;
-    uint32_t s = strtol(buff, &endptr, 8);
-    attest(endptr && (*endptr == '\0'),
-           "unable to decode file size from tar header");
-    s += 0x200;
-    off = lseek(fd, s, SEEK_SET);
-    attest((s == (uint32_t)off),
-           "unable to seek to end of tar-blob");
+                Stripe s = {buff, stripe, numRead, rcvr, zero};
+                toCompute.Push(s);
+            }
+        }
+        Stripe end = {0, 0, 0, 0, false};
+        toCompute.Push(end);
+    });
 
-    signature chk;
-    rc = read(fd, &chk, sizeof(chk));
-    attest((rc == sizeof(chk)),
-           "unable to read signature block");
-    // might not know numData yet either...
-    if (sig.numData == 255)
+    // write out what's been recovered, then the buffer can be re-used
+    std::thread writer([&]()
     {
-        sig.numData   = chk.numData;
-        sig.numParity = chk.numParity;
-    }
-    else
+        IoNear(out);
+        for (Stripe s = toWrite.Pop(); s.buff; s = toWrite.Pop())
+        {
+            uint64_t t = stats.start();
+            const uint64_t w = throttle.start();
+            ssize_t numWritten = write(out, s.buff[0], s.numRead);
+            attest(numWritten == s.numRead, "Expected to write %zd, wrote %zd",
+                   s.numRead, numWritten);
+            throttle.Write(numWritten, w);
+            stats.syscall(Stats::WRITE);
+            stats.stop(Stats::WRITE, t, numWritten);
+            stats.stripe(numWritten);
+            PROBE2(stripe_end, s.index, numWritten);
+            if (verify)
+            {
+                // what was read, rather than rebuilt, is as it was
+                uint8_t read[rows];
+                gfm_decoder_needs(s.rcvr, read);
+                verify->Push(s.buff, read, numWritten, layout.shift(s.index));
+                continue;
+            }
+            pool->Put(s.buff);
+        }
+    });
+
+    for (Stripe s = toCompute.Pop(); s.buff; s = toCompute.Pop())
     {
-        // numParity not known at this stage, so cheat
-        chk.numParity = sig.numParity;
+        uint64_t t = stats.start();
+        // all holes, the data is the zeros it was cleared to
+        if (!s.zero)
+        {
+            gfm_decode(s.rcvr, s.buff, BLOCKSIZE);
+        }
+        stats.stop(Stats::DECODE, t, numData * BLOCKSIZE);
+        PROBE2(decode_done, s.index, numData * BLOCKSIZE);
+
+        CheckPadding(s.buff[0], numData, s.index,
+                     (s.index + 1) == numStripes);
+        s.numRead = gfm_unpad(s.buff[0], numData * BLOCKSIZE);
+        attest(s.numRead >= 0, "Stripe %llu is damaged, unable to recover",
+               (unsigned long long)s.index);
+        toWrite.Push(s);
     }
-    // check that
-    if (memcmp(&sig, &chk, sizeof(sig)))
+    Stripe end = {0, 0, 0, 0, false};
+    toWrite.Push(end);
+    reader.join();
+    writer.join();
+    // it has the last of the stripes
+    if (verify)
     {
-        close(fd);
-        return 0;
+        verify->Drain();
     }
 
-    // see to next BLOCKSIZE boundary
-    off += sizeof(signature) + BLOCKSIZE - 1;
-    off &= ~(BLOCKSIZE - 1);
-    attest((lseek(fd, off, SEEK_SET) == off),
-           "unable to seek to end of tar-blob (0x%x): %m", off);
+    for (int idx = 0; idx < rows; idx++)
+    {
+        if (fds[idx]) close(fds[idx]);
+    }
 
-    return fd;
+    delete pool;
+    for (auto & d : decoders)
+    {
+        gfm_decoder_destroy(d.second);
+    }
 }
 
-int OpenFile(const std::string & filename,
-	     uint8_t idx,
-	     GFM & gfm,
-	     signature & sig)
+/**
+   Recover bytes [offset, offset + length) of the stream (length 0
+   for the rest of it). Stripes outside the range are skipped, and in
+   the ones that aren't only the data shards covering the range are
+   read and rebuilt (or whatever they're rebuilt from).
+*/
+void RecoverRange(const uint8_t numData,
+                  const gfm_codec * codec,
+                  uint32_t rotate,
+                  int * fds,
+                  uint64_t numStripes,
+                  uint64_t offset,
+                  uint64_t length)
 {
-    int fd = OpenFile(filename, sig);
-    if (fd)
+    const int rows = gfm_codec_shards(codec);
+    const Layout layout = {rows, rotate};
+    // by shard, the decoders want it by row
+    std::vector<uint8_t> lost(rows);
+    off_t   start[rows];
+    const bool known = numStripes;
+    for (int idx = 0; idx < rows; idx++)
     {
-        return fd;
+        lost[idx] = !fds[idx];
+        if (!fds[idx]) continue;
+        // OpenFile() left it at the first block
+        start[idx] = lseek(fds[idx], 0, SEEK_CUR);
+        // unless the manifest says, the longest. Any shorter ones
+        // have been cut short.
+        struct stat st;
+        if (!known && !fstat(fds[idx], &st) && (st.st_size > start[idx]))
+        {
+            numStripes = std::max<uint64_t>(numStripes,
+                                            (st.st_size - start[idx]) / BLOCKSIZE);
+        }
     }
-    gfm.failData(idx);
-    return 0;
-}
 
-void RecoverData(const uint8_t numData,
-		 const uint8_t numParity,
-		 GFM & gfm,
-		 int * fds)
-{
-    uint8_t ** buff = GFM::makeArray(numData + numParity, BLOCKSIZE);
-    uint8_t ** rcvr = gfm.recovery();
+    attest(numStripes, "The shards end before the first stripe");
 
-    while(1)
-    {
-        memset(buff[0], 0, (numData + numParity) * BLOCKSIZE);
+    StripePool * pool = MakePool(rows);
+    uint8_t ** buff = pool->Get();
 
-        ssize_t numRead = 0;
+    // payload in every stripe but the last, which may be short
+    const uint64_t perStripe = (numData * BLOCKSIZE) - 1;
+    const uint64_t end = (length && ((offset + length) > offset))
+        ? offset + length
+        : UINT64_MAX;
 
-        for (int idx = 0; idx < (numData + numParity); idx++)
-	{
-            if (fds[idx])
-	    {
-                numRead += readFully(fds[idx], buff[idx], BLOCKSIZE);
-	    }
-	}
+    // one for each set of erased and wanted rows, i.e. not many
+    std::map<std::vector<uint8_t>, gfm_decoder *> decoders;
 
-        if (numRead <= 0)
-	{
+    for (uint64_t stripe = offset / perStripe; stripe < numStripes; stripe++)
+    {
+        const uint64_t base = stripe * perStripe;
+        if (base >= end)
+        {
             break;
-	}
-        gfm.recover(buff, rcvr, BLOCKSIZE);
+        }
+        size_t lo = (offset > base) ? (offset - base) : 0;
+        size_t hi = std::min(end - base, perStripe);
+        const bool last = ((stripe + 1) == numStripes);
+
+        std::vector<uint8_t> wanted(numData, 0);
+        for (size_t row = lo / BLOCKSIZE; row <= ((hi - 1) / BLOCKSIZE); row++)
+        {
+            wanted[row] = 1;
+        }
+        // the padding is recorded at the very end of the last stripe
+        if (last)
+        {
+            wanted[numData - 1] = 1;
+        }
+        PROBE2(stripe_start, stripe, numData * BLOCKSIZE);
+        uint64_t t = stats.start();
+        ssize_t numRead = 0;
+        gfm_decoder * rcvr = 0;
+        // again without any shard that's come up short
+        for (bool retry = true; retry; )
+        {
+            retry = false;
+            std::vector<uint8_t> erased(rows);
+            for (int row = 0; row < rows; row++)
+            {
+                erased[row] = lost[layout.shard(row, stripe)];
+            }
+            std::vector<uint8_t> key(erased);
+            key.insert(key.end(), wanted.begin(), wanted.end());
+            gfm_decoder *& d = decoders[key];
+            if (!d)
+            {
+                int rc = gfm_decoder_create_partial(codec, erased.data(),
+                                                    wanted.data(), &d);
+                attest(rc == GFM_OK, "Unable to recover stripe %llu: %s",
+                       (unsigned long long)stripe, gfm_strerror(rc));
+            }
+            rcvr = d;
+            uint8_t needed[rows];
+            gfm_decoder_needs(rcvr, needed);
+
+            for (int row = 0; !retry && (row < rows); row++)
+            {
+                if (!needed[row]) continue;
+                const int idx = layout.shard(row, stripe);
+                PROBE3(shard_read_start, stripe, idx, BLOCKSIZE);
+                ssize_t got = ShardRead(fds[idx], idx, buff[row], BLOCKSIZE,
+                                        start[idx] + (stripe * BLOCKSIZE));
+                PROBE3(shard_read_done, stripe, idx, got);
+                stats.syscall(Stats::READ, got < (ssize_t)BLOCKSIZE);
+                if (got != (ssize_t)BLOCKSIZE)
+                {
+                    std::cerr << "Shard " << idx << " ends at stripe "
+                              << stripe << ", recovering without it"
+                              << std::endl;
+                    close(fds[idx]);
+                    fds[idx]  = 0;
+                    lost[idx] = 1;
+                    retry = true;
+                    break;
+                }
+                numRead += got;
+            }
+        }
+        stats.stop(Stats::READ, t, numRead);
 
-        size_t numToWrite = removePadding(buff[0], numData * BLOCKSIZE);
+        t = stats.start();
+        gfm_decode(rcvr, buff, BLOCKSIZE);
+        stats.stop(Stats::DECODE, t, numData * BLOCKSIZE);
+        PROBE2(decode_done, stripe, numData * BLOCKSIZE);
 
-        size_t rc = write(1, buff[0], numToWrite);//numData * BLOCKSIZE);
-        attest(rc == numToWrite, "Expected to write %zd, wrote %zd", numToWrite, rc);
+        // the flag is only there if its row was
+        if (wanted[numData - 1])
+        {
+            CheckPadding(buff[0], numData, stripe, last);
+        }
+        if (last)
+        {
+            ssize_t len = gfm_unpad(buff[0], numData * BLOCKSIZE);
+            attest(len >= 0, "Stripe %llu is damaged, unable to recover",
+                   (unsigned long long)stripe);
+            hi = std::min(hi, (size_t)len);
+        }
+        ssize_t numToWrite = (hi > lo) ? (hi - lo) : 0;
+
+        t = stats.start();
+        const uint64_t w = throttle.start();
+        ssize_t numWritten = write(1, buff[0] + lo, numToWrite);
+        attest(numWritten == numToWrite, "Expected to write %zd, wrote %zd",
+               numToWrite, numWritten);
+        throttle.Write(numWritten, w);
+        stats.syscall(Stats::WRITE);
+        stats.stop(Stats::WRITE, t, numWritten);
+        stats.stripe(numWritten);
+        PROBE2(stripe_end, stripe, numWritten);
     }
 
-    for (int idx = 0; idx < (numData + numParity); idx++)
+    for (auto & d : decoders)
     {
-        close(fds[idx]);
+        gfm_decoder_destroy(d.second);
     }
-
-    free(buff);
-    free(rcvr);
+    for (int idx = 0; idx < rows; idx++)
+    {
+        if (fds[idx]) close(fds[idx]);
+    }
+    pool->Put(buff);
+    delete pool;
 }
 
 /**
-   Recover given only the filename stub.
+   Recover given only the filename stub. Returns the exit status,
+   which is only ever not 0 if --verify finds something wrong.
 */
-void RecoverData(const std::string & stub)
+int RecoverData(const std::string & stub)
 {
     int fds[250] = {0,};
 
@@ -952,12 +1721,35 @@ void RecoverData(const std::string & stub)
     sig.numParity = 255;
     //  sig.fileNum = 0;;
     sig.blocksizePo2 = BLOCKSIZE_Po2;
+    uint8_t compression = SHARD_PLAIN;
+    uint8_t numGroups   = 0;
+    uint32_t rotate     = 0;
+    // 0 if only the shards themselves say
+    uint64_t numStripes = 0;
+
+    // STUB.shards says where they all are, and how long
+    unsigned numOpen = 0;
+    const bool haveManifest = OpenManifest(stub, fds, sig.numData,
+                                           sig.numParity, numGroups,
+                                           rotate, compression,
+                                           numStripes, numOpen);
+    if (haveManifest)
+    {
+        expected.fileNum = numOpen;
+    }
 
-    for (int idx = 0; idx < 250; idx++)
+    // otherwise look for them, all of them as any beyond numData are spares
+    for (int idx = 0;
+         !haveManifest &&
+             (idx < (expected.fileNum
+                     ? (expected.numData + expected.numParity + numGroups)
+                     : 250));
+         idx++)
     {
         sig.fileNum = idx;
         std::string filename =  MakeFilename(stub, idx);
-        fds[idx] = OpenFile(filename, sig);
+        shardHeader info;
+        fds[idx] = OpenFile(filename, sig, &info);
         if (fds[idx] > 0)
 	{
             if (!expected.fileNum++)
@@ -965,6 +1757,9 @@ void RecoverData(const std::string & stub)
                 expected.numData   = sig.numData;
                 expected.numParity = sig.numParity;
                 expected.blocksizePo2 = sig.blocksizePo2;
+                compression = info.compression;
+                numGroups   = info.numGroups;
+                rotate      = info.rotate;
                 continue;
 	    }
 
@@ -977,15 +1772,19 @@ void RecoverData(const std::string & stub)
             attest(expected.blocksizePo2 == sig.blocksizePo2,
                    "signature.blocksizePo2 inconsistent: %s",
                    filename.c_str());
-            if (expected.fileNum < sig.numData)
-	    {
-                continue;
-	    }
-            break;
+            attest(compression == info.compression,
+                   "signature.compression inconsistent: %s",
+                   filename.c_str());
+            attest(numGroups == info.numGroups,
+                   "signature.numGroups inconsistent: %s",
+                   filename.c_str());
+            attest(rotate == info.rotate,
+                   "signature.rotate inconsistent: %s",
+                   filename.c_str());
 	}
     }
     // did we manage to open any files?
-    if (!expected.fileNum)
+    if (!expected.fileNum && !haveManifest)
     {
         int fd = (stub == "-")
             ? STDOUT_FILENO
@@ -998,7 +1797,7 @@ void RecoverData(const std::string & stub)
         size_t s = _binary_gfm_tar_len - 0x200;
         size_t numWritten = write(
             fd,
-            &_binary_gfm_tar_start + 0x200, s);
+            _binary_gfm_tar_start + 0x200, s);
         attest(numWritten == s,
                "only wrote %zd of %zd to %s",
                numWritten, s,
@@ -1013,47 +1812,367 @@ void RecoverData(const std::string & stub)
 
     const uint8_t numData   = sig.numData;
     const uint8_t numParity = sig.numParity;
-    attest((numData + numParity) <= 250,
-           "Signature invalid, number of files (data + parity) "
+    attest(((numData + numParity + numGroups) <= 250) &&
+           (numGroups <= numData),
+           "Signature invalid, number of files (data + parity + groups) "
            "must not exceed 250: '%s'", stub.c_str());
 
     attest(expected.fileNum >= numData,
            "Unable to recover, need at least %i files available: '%s'",
            numData, stub.c_str());
 
-    GFM gfm (numData, numParity);
-
-    for (int idx = 0; idx < (numData + numParity); idx++)
+    attest(compression <= SHARD_ZSTD,
+           "Unknown compression %u: '%s'", compression, stub.c_str());
+    // decompress on the way out if it was compressed on the way in
+    bool unzstd = (compression == SHARD_ZSTD);
+    if (unzstd && !ZStage::available())
     {
-        if (!fds[idx])
-	{
-            gfm.failData(idx);
-	}
+        std::cerr << "gfm was built without zstd, this is the compressed"
+                  << " stream, try '| zstd -d'" << std::endl;
+        unzstd = false;
+    }
+    attest((hedgeExtra < 0) || !wantRange,
+           "--hedge doesn't work with --range: '%s'", stub.c_str());
+    attest(!wantVerify || !wantRange,
+           "--verify doesn't work with --range: '%s'", stub.c_str());
+    attest(!wantVerify || unzstd || (compression != SHARD_ZSTD),
+           "--verify needs zstd for --zstd shards: '%s'", stub.c_str());
+    attest(!unzstd || !wantRange,
+           "--range doesn't work on --zstd shards: '%s'", stub.c_str());
+
+    gfm_codec * codec = MakeCodec(numData, numParity, numGroups);
+
+    // --verify: the digests in STUB.md5, by name
+    Verifier * verify = 0;
+    if (wantVerify)
+    {
+        std::vector<std::string> names;
+        for (unsigned idx = 0; idx < gfm_codec_shards(codec); idx++)
+        {
+            names.push_back(StripDir(MakeFilename(stub, idx)));
+        }
+        verify = new Verifier(stub + ".md5", names, BLOCKSIZE);
+        attest(verify->good(), "Unable to read '%s.md5'", stub.c_str());
     }
 
     // now that we have opened all the files, start the recovery.
-    RecoverData(numData,
-                numParity,
-                gfm,
-                fds);
+    if (wantRange)
+    {
+        RecoverRange(numData, codec, rotate, fds, numStripes,
+                     rangeOffset, rangeLength);
+    }
+    else if (unzstd)
+    {
+        int p[2];
+        attest(!pipe(p), "Unable to create pipe: %m");
+        ZStage zstd(false, p[0], dup(STDOUT_FILENO), 0, zstdThreads,
+                    verify ? verify->streamDigest() : 0);
+        RecoverData(numData, codec, rotate, fds, numStripes, p[1], verify);
+        // that's the end of the compressed stream
+        close(p[1]);
+        zstd.Join();
+    }
+    else
+    {
+        RecoverData(numData,
+                    codec,
+                    rotate,
+                    fds,
+                    numStripes,
+                    STDOUT_FILENO,
+                    verify);
+    }
+
+    gfm_codec_destroy(codec);
+
+    int status = 0;
+    if (verify && !verify->Report())
+    {
+        status = 1;
+    }
+    delete verify;
+    return status;
 }
 
 void rtfm(const std::string & prog)
 {
     std::cerr << "\t# " GIT_TAG "\n"
               << prog <<
-        " STUB [NUM_DATA NUM_PARITY]\n"
+        " [OPTIONS] STUB [NUM_DATA NUM_PARITY]\n"
         "\tSTUB         filename stub for files\n"
         "\tNUM_DATA     number of data files\n"
         "\tNUM_PARITY   number of parity files\n"
               << prog <<
         "\tDUMP.tar.xz  dump embedded data\n"
+              << prog <<
+        " --bench [...] in-memory encode/decode benchmark\n"
+              << prog <<
+        " [OPTIONS] --batch MANIFEST  encode each INPUT STUB NUM_DATA NUM_PARITY line\n"
+        "OPTIONS\n"
+        "\t--stats[=FILE]  time each stage, summary to stderr (or JSON to FILE)\n"
+        "\t--progress      MB/s (and ETA) on stderr as it goes\n"
+        "\t--mem-limit=N   at most N bytes (K, M or G) of stripe buffers\n"
+        "\t--huge-pages    back the stripe buffers with huge pages\n"
+        "\t--range=OFF[:LEN]  recover only LEN bytes (or the rest) from OFF\n"
+        "\t--hedge[=N]    recover from the first shards to arrive, of N (or all) more\n"
+        "\t--verify       check the output and shards read against STUB.md5\n"
+        "\t--zstd[=LEVEL] compress with zstd (level 3) on all CPUs first\n"
+        "\t--zstd-threads=N  zstd on N threads (default one per CPU)\n"
+        "\t--blobs=N      only the first N shards get the tarball (0 for none)\n"
+        "\t--lrc=GROUPS   plus an XOR parity shard per group of data shards\n"
+        "\t--rotate[=N]   move data and parity along a shard every N (1) stripes\n"
+        "\t--stream[=DEPTH]  one stream STUB (- for stdout/stdin), not files,\n"
+        "\t               DEPTH (32) stripes interleaved\n"
+        "\t--read-limit=N   read at most N bytes (K, M or G) a second\n"
+        "\t--write-limit=N  write at most N bytes a second\n"
+        "\t--shard-limit=N  at most N bytes a second to or from any one shard\n"
+        "\t--write-latency=MS  slow writing down while writes take over MS ms\n"
+        "\t--idle         idle I/O priority (and nice), for background jobs\n"
+        "\t--numa[=NODE]  stripe buffers and coding on NODE (or where it started),\n"
+        "\t               with --batch spread over all the nodes\n"
+        "\t--numa-io=NODE|auto  readers and writers on NODE (or their disk's)\n"
+        "\t--jobs=N       --batch: N files at a time (default one per CPU)\n"
+        "\t--io-limit=N   --batch: at most N reads/writes in progress at once\n"
               << std::endl;
     exit(1);
 }
 
+// "64M" and the like, 0 if it makes no sense
+size_t ParseSize(const char * str)
+{
+    char * end = 0;
+    unsigned long long n = strtoull(str, &end, 0);
+    switch (*end)
+    {
+    case 'G': case 'g': n <<= 10; // fall through
+    case 'M': case 'm': n <<= 10; // fall through
+    case 'K': case 'k': n <<= 10; end++;
+    }
+    return ((end != str) && !*end) ? n : 0;
+}
+
+void ReportStats()
+{
+    stats.Report();
+    throttle.Report();
+}
+
 int main(int argc, char ** argv)
 {
+    // options come first, GFM_STATS=1 (or =FILE) is the same as --stats
+    const char * statsEnv = getenv("GFM_STATS");
+    bool wantStats = statsEnv;
+    std::string statsFile = (statsEnv && strcmp(statsEnv, "1")) ? statsEnv : "";
+    ParseDelays(getenv("GFM_DELAY"));
+    bool progress = false;
+    unsigned numJobs = 0;
+    unsigned numIo   = 0;
+    while ((argc > 1) &&
+           !strncmp(argv[1], "--", 2) &&
+           strcmp(argv[1], "--bench") &&
+           strcmp(argv[1], "--batch"))
+    {
+        if (!strcmp(argv[1], "--stats"))
+        {
+            wantStats = true;
+        }
+        else if (!strncmp(argv[1], "--stats=", 8))
+        {
+            wantStats = true;
+            statsFile = argv[1] + 8;
+        }
+        else if (!strcmp(argv[1], "--progress"))
+        {
+            progress = true;
+        }
+        else if (!strncmp(argv[1], "--mem-limit=", 12))
+        {
+            memLimit = ParseSize(argv[1] + 12);
+            attest(memLimit, "Bad --mem-limit: '%s'", argv[1] + 12);
+        }
+        else if (!strcmp(argv[1], "--huge-pages"))
+        {
+            hugePages = true;
+        }
+        else if (!strncmp(argv[1], "--range=", 8))
+        {
+            char * end = 0;
+            wantRange   = true;
+            rangeOffset = strtoull(argv[1] + 8, &end, 0);
+            if (*end == ':')
+            {
+                rangeLength = strtoull(end + 1, &end, 0);
+                attest(rangeLength, "Bad --range length: '%s'", argv[1] + 8);
+            }
+            attest(!*end, "Bad --range: '%s'", argv[1] + 8);
+        }
+        else if (!strcmp(argv[1], "--zstd"))
+        {
+            useZstd = true;
+        }
+        else if (!strncmp(argv[1], "--zstd=", 7))
+        {
+            char * end = 0;
+            useZstd   = true;
+            zstdLevel = strtol(argv[1] + 7, &end, 0);
+            attest((end != argv[1] + 7) && !*end,
+                   "Bad --zstd level: '%s'", argv[1] + 7);
+        }
+        else if (!strncmp(argv[1], "--zstd-threads=", 15))
+        {
+            zstdThreads = atoi(argv[1] + 15);
+            attest(zstdThreads, "Bad --zstd-threads: '%s'", argv[1] + 15);
+        }
+        else if (!strncmp(argv[1], "--blobs=", 8))
+        {
+            char * end = 0;
+            numBlobs = strtol(argv[1] + 8, &end, 0);
+            attest((end != argv[1] + 8) && !*end && (numBlobs >= 0),
+                   "Bad --blobs: '%s'", argv[1] + 8);
+        }
+        else if (!strcmp(argv[1], "--hedge"))
+        {
+            hedgeExtra = 250;
+        }
+        else if (!strncmp(argv[1], "--hedge=", 8))
+        {
+            char * end = 0;
+            hedgeExtra = strtol(argv[1] + 8, &end, 0);
+            attest((end != argv[1] + 8) && !*end && (hedgeExtra >= 0),
+                   "Bad --hedge: '%s'", argv[1] + 8);
+        }
+        else if (!strcmp(argv[1], "--verify"))
+        {
+            wantVerify = true;
+        }
+        else if (!strncmp(argv[1], "--lrc=", 6))
+        {
+            char * end = 0;
+            long groups = strtol(argv[1] + 6, &end, 0);
+            attest((end != argv[1] + 6) && !*end &&
+                   (groups >= 0) && (groups < 250),
+                   "Bad --lrc: '%s'", argv[1] + 6);
+            lrcGroups = groups;
+        }
+        else if (!strcmp(argv[1], "--rotate"))
+        {
+            rotateStripes = 1;
+        }
+        else if (!strncmp(argv[1], "--rotate=", 9))
+        {
+            char * end = 0;
+            unsigned long every = strtoul(argv[1] + 9, &end, 0);
+            attest((end != argv[1] + 9) && !*end &&
+                   every && (every <= UINT32_MAX),
+                   "Bad --rotate: '%s'", argv[1] + 9);
+            rotateStripes = every;
+        }
+        else if (!strcmp(argv[1], "--stream"))
+        {
+            streamDepth = 32;
+        }
+        else if (!strncmp(argv[1], "--stream=", 9))
+        {
+            char * end = 0;
+            long depth = strtol(argv[1] + 9, &end, 0);
+            attest((end != argv[1] + 9) && !*end &&
+                   (depth > 0) && (depth <= 0xffff),
+                   "Bad --stream depth: '%s'", argv[1] + 9);
+            streamDepth = depth;
+        }
+        else if (!strncmp(argv[1], "--read-limit=", 13))
+        {
+            size_t rate = ParseSize(argv[1] + 13);
+            attest(rate, "Bad --read-limit: '%s'", argv[1] + 13);
+            throttle.SetRead(rate);
+        }
+        else if (!strncmp(argv[1], "--write-limit=", 14))
+        {
+            size_t rate = ParseSize(argv[1] + 14);
+            attest(rate, "Bad --write-limit: '%s'", argv[1] + 14);
+            throttle.SetWrite(rate);
+        }
+        else if (!strncmp(argv[1], "--shard-limit=", 14))
+        {
+            size_t rate = ParseSize(argv[1] + 14);
+            attest(rate, "Bad --shard-limit: '%s'", argv[1] + 14);
+            throttle.SetShard(rate);
+        }
+        else if (!strncmp(argv[1], "--write-latency=", 16))
+        {
+            char * end = 0;
+            double ms = strtod(argv[1] + 16, &end);
+            attest((end != argv[1] + 16) && !*end && (ms > 0),
+                   "Bad --write-latency: '%s'", argv[1] + 16);
+            throttle.SetLatency(ms * 1e6);
+        }
+        else if (!strcmp(argv[1], "--idle"))
+        {
+            // the idle I/O class: only the disk time nobody else wants.
+            // Before any threads, they inherit it.
+            const int IOPRIO_CLASS_IDLE = 3, IOPRIO_CLASS_SHIFT = 13;
+            const int IOPRIO_WHO_PROCESS = 1;
+            attest(!syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                            IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT),
+                   "Unable to set idle I/O priority: %m");
+            attest(!setpriority(PRIO_PROCESS, 0, 19),
+                   "Unable to set nice: %m");
+        }
+        else if (!strcmp(argv[1], "--numa"))
+        {
+            numaNode = NUMA_AUTO;
+        }
+        else if (!strncmp(argv[1], "--numa=", 7))
+        {
+            char * end = 0;
+            long node = strtol(argv[1] + 7, &end, 0);
+            attest((end != argv[1] + 7) && !*end &&
+                   (node >= 0) && (node < Numa::nodes()),
+                   "Bad --numa node: '%s' (of %d)", argv[1] + 7, Numa::nodes());
+            numaNode = node;
+        }
+        else if (!strncmp(argv[1], "--numa-io=", 10))
+        {
+            char * end = 0;
+            long node = strtol(argv[1] + 10, &end, 0);
+            if (!strcmp(argv[1] + 10, "auto"))
+            {
+                numaIo = NUMA_AUTO;
+            }
+            else
+            {
+                attest((end != argv[1] + 10) && !*end &&
+                       (node >= 0) && (node < Numa::nodes()),
+                       "Bad --numa-io node: '%s' (of %d)", argv[1] + 10,
+                       Numa::nodes());
+                numaIo = node;
+            }
+        }
+        else if (!strncmp(argv[1], "--jobs=", 7))
+        {
+            numJobs = atoi(argv[1] + 7);
+            attest(numJobs, "Bad --jobs: '%s'", argv[1] + 7);
+        }
+        else if (!strncmp(argv[1], "--io-limit=", 11))
+        {
+            numIo = atoi(argv[1] + 11);
+            attest(numIo, "Bad --io-limit: '%s'", argv[1] + 11);
+        }
+        else
+        {
+            rtfm(argv[0]);
+        }
+        // shift the option out
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+    if (wantStats || progress)
+    {
+        stats.Enable(wantStats, statsFile, progress);
+        atexit(ReportStats);
+    }
+
     // Execute built-in test, verbose if requested
     if(getenv("BIT"))
     {
@@ -1075,12 +2194,39 @@ int main(int argc, char ** argv)
         dumpFile.open(filename.c_str());
     }
 
+    // benchmark, no files involved
+    if ((argc >= 2) && !strcmp(argv[1], "--bench"))
+    {
+        exit(Bench(argc - 1, argv + 1));
+    }
+
+    // many files, one codec per geometry
+    if ((argc == 3) && !strcmp(argv[1], "--batch"))
+    {
+        attest(!streamDepth, "--stream doesn't work with --batch");
+        exit(Batch(argv[2], numJobs, numIo));
+    }
+
+    // --numa: the pipeline's threads start from here, and its stripes
+    // are allocated here. Left to itself it stays on this node.
+    if (numaNode != NUMA_ANY)
+    {
+        Numa::runOn((numaNode == NUMA_AUTO) ? Numa::here() : numaNode);
+    }
+
     // recovery.
     // Specify the file stub
     if (argc == 2)
     {
-        RecoverData(argv[1]);
-        exit(0);
+        if (streamDepth)
+        {
+            attest(!wantRange && (hedgeExtra < 0) && !wantVerify,
+                   "--stream doesn't do --range, --hedge or --verify"
+                   " (it's checked as it goes)");
+            exit(StreamDecode(argv[1], STDOUT_FILENO,
+                              BLOCKSIZE, BLOCKSIZE_Po2));
+        }
+        exit(RecoverData(argv[1]));
     }
 
     // generation mode.
@@ -1093,7 +2239,8 @@ int main(int argc, char ** argv)
 
         if (numData < 0)
         {
-            _binary_gfm_tar_len = 0;
+            // same as --blobs=0
+            numBlobs = 0;
             numData = -numData;
         }
         attest((numData > 0) && (numData < 250),
@@ -1102,8 +2249,29 @@ int main(int argc, char ** argv)
                "You must specify between 1 and 249 parity files");
         attest((numData + numParity) <= 250,
                "Number of files (data + parity) must not exceed 250");
-
-        CreateParity(numData, numParity, argv[1]);
+        attest((int)lrcGroups <= numData,
+               "No more --lrc groups than data files");
+        attest((numData + numParity + lrcGroups) <= 250,
+               "Number of files (data + parity + groups) must not exceed 250");
+
+        gfm_codec * codec = MakeCodec(numData, numParity, lrcGroups);
+        // for the progress ETA, if stdin is a file
+        struct stat st;
+        if (!fstat(0, &st) && S_ISREG(st.st_mode))
+        {
+            stats.Expect(st.st_size);
+        }
+        if (streamDepth)
+        {
+            StreamEncode(codec, 0, argv[1], BLOCKSIZE, BLOCKSIZE_Po2,
+                         streamDepth);
+        }
+        else
+        {
+            attest(CreateParity(codec, 0, argv[1]),
+                   "Unable to create the shards: '%s'", argv[1]);
+        }
+        gfm_codec_destroy(codec);
         exit(0);
     }
 
@@ -0,0 +1,843 @@
+#ifndef GFM_HH
+#define GFM_HH
+
+#include "gfa.hh"
+#include "gfk.hh"
+
+#include <algorithm>
+#include <assert.h>
+#include <iostream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+// the stream framing used by the gfm tool.
+// The last byte of every stripe flags how much of it is padding,
+// 'expected' is the size of the stripe less that flag byte.
+void   addPadding(uint8_t * buff, ssize_t numRead, ssize_t expected);
+size_t removePadding(uint8_t * buff, size_t buffSize);
+
+/// Gallois Field Matrix
+class GFM
+{
+public:
+    // the matrix is dumped to 'dump' (if given) as it is built,
+    // see the DMP environment variable.
+    GFM(uint8_t _numData, uint8_t _numParity, std::ostream * _dump = 0)
+        : kernel(gfKernel(0))
+        , useFixed(true)
+        , dump(_dump)
+        , numData(_numData)
+        , numParity(_numParity)
+        {
+            int rows = numData + numParity;
+            // could go as high as 255, but 250
+            // is neater. Callers are expected to have checked.
+            assert(rows <= 250);
+
+            // create an array to calculate the parity
+            d = makeArray(rows, numData + 1);
+            if (!d)
+            {
+                // leave it to the caller to check good()
+                return;
+            }
+/*
+            NEW AND IMPROVED
+            based on original and updated papers
+
+http://web.eecs.utk.edu/~plank/plank/papers/CS-03-504.pdf
+http://web.eecs.utk.edu/~plank/plank/papers/CS-03-504.pdf
+
+            Start with a "Vandermode" matrix, which is guaranteed
+            invertible if you reduce and numParity rows
+
+            [0^0 0^1 0^2 ...   [1 0 0
+            [1^0 1^1 1^2 ...   [1 1 1
+            [2^0 2^1 2^2 ...   [1 2
+            [3^0 3^1 3^2 ...   [1 3
+            [4^0 4^1 4^2 ...   [1 4
+
+*/
+            // first row, add 1 (makeArray initialises to)
+            d[0][0] = 1;
+            // second row all 1
+            for (int col = 0; col < numData; col++)
+            {
+                d[1][col] = 1;
+            }
+            // third and successive rows
+            for (int row = 2; row < rows; row++)
+            {
+                // first column, all 1
+                d[row][0] = 1;
+                // second column, row number
+                d[row][1] = row;
+                // rest of the columns, powers of "row"
+                for (int col = 2; col < numData; col++)
+                {
+                    d[row][col] = gfa.mult(d[row][col-1], row);
+                }
+            }
+            if (dump) print("Vandermonde", *dump);
+/*
+            now we have to apply "elementary operations"
+            to reduce the top part into an identity matrix
+            first row is already in the right format
+*/
+            for (int row = 1; row < numData; ++row)
+            {
+                // we need to make d[row][row] == 1 and
+                // the rest of row == 0 without disturbing the previous
+                // rows.
+                // first, ensure that d[row][row] is non-zero,
+                // swap with a later column if needed
+                if (!d[row][row])
+                {
+                    for (int col = row+1; col < numData; ++col)
+                    {
+                        if (!d[row][col]) continue;
+                        // found a candidate column to swap with
+                        for (int idx = row; idx < rows; ++idx)
+                        {
+                            uint8_t tmp = d[idx][row];
+                            d[idx][row] = d[idx][col];
+                            d[idx][col] = tmp;
+                        }
+                        break;
+                    }
+//                    print("swapped...");
+                }
+                // scale if necessary to ensure a major diagonal of 1
+                if (d[row][row] != 1)
+                {
+                    uint8_t inv = gfa.div(1,d[row][row]);
+                    for (int col = 0; col < numData; ++col)
+                    {
+                        d[row][col] = gfa.mult(inv,d[row][col]);
+                    }
+//                    print("scaled...");
+                }
+                // now zero-out the other columns
+                for (int col = 0; col < numData; ++col)
+                {
+                    // leave the major diagonal alone
+                    if (row == col) continue;
+                    // already zero?
+                    if (!d[row][col]) continue;
+                    // take away multiples of the row'th column
+                    uint8_t mult = d[row][col];
+                    for (int idx = row; idx < rows; ++idx)
+                    {
+                        d[idx][col] ^= gfa.mult(mult,d[idx][row]);
+                    }
+                }
+//                print("reduced...");
+            }
+            if (dump) print("Parity", *dump);
+            // make sure we got it right...
+            // identity matrix at the top
+            for (int row = 0; row < numData; ++row)
+            {
+                for (int col = 0; col < numData; ++col)
+                {
+                    assert(d[row][col] == (row == col) ? 1 : 0);
+                }
+            }
+            // the rest must not be zero
+            for (int row = numData; row < rows; ++row)
+            {
+                for (int col = 0; col < numData; ++col)
+                {
+                    assert(d[row][col]);
+                }
+            }
+        };
+
+    // ye olde destructor
+    virtual ~GFM()
+        {
+            free(d);
+            d = 0;
+        }
+
+    // false if the constructor was unable to allocate the matrix
+    bool good() const
+        {
+            return d;
+        }
+
+    uint8_t dataRows() const
+        {
+            return numData;
+        }
+
+    uint8_t parityRows() const
+        {
+            return numParity;
+        }
+
+    // which of the gfKernels[] to use for parity() and recover(),
+    // 0 for the best available. Returns false if not supported.
+    bool setKernel(const char * name)
+        {
+            const GFK * k = gfKernel(name);
+            if (!k)
+            {
+                return false;
+            }
+            kernel = k;
+            return true;
+        }
+
+    const char * kernelName() const
+        {
+            return kernel->name;
+        }
+
+    // use the kernel's compile time specialised matrix multiply
+    // where there is one for the geometry (default), or not
+    void setFixed(bool fixed)
+        {
+            useFixed = fixed;
+        }
+
+    // the specialised matrix multiply for numData inputs and
+    // 'numOut' outputs, 0 to use the generic loops
+    GFKMatrix fixedKernel(unsigned numOut) const
+        {
+            if (!useFixed || !kernel->fixed)
+            {
+                return 0;
+            }
+            return kernel->fixed(numData, numOut);
+        }
+
+    // helper function to create a 2-dimensional array of
+    // bytes that can be free'd with a single free().
+    // More importantly, the rows are arranged such that
+    // [n][cols] == [n+1][0] so we can read/write the
+    // whole thing with a single call.
+    // Returns 0 if the memory can't be had.
+    static uint8_t ** makeArray(size_t rows, size_t cols)
+        {
+            size_t numCells = rows * cols;
+            // allocate enough memory for the backbone and the cells
+            size_t size =
+                (rows     * sizeof(uint8_t *)) +
+                (numCells * sizeof(uint8_t));
+            uint8_t ** ret = (uint8_t **)calloc(size,1);
+            if (!ret)
+            {
+                return 0;
+            }
+
+            // first row starts just after the backbone
+            ret[0] = (uint8_t *)&ret[rows];
+            // subsequent rows abut
+            for (size_t i = 1; i < rows; i++)
+            {
+                ret[i] = ret[i-1] + cols;
+            }
+            return ret;
+        }
+
+    // calculate the parity bits for a whole block of data
+    //  data [0..len-1][0..(numData+numParity-1]
+    inline void parity(uint8_t * const * data, size_t len) const
+        {
+            GFKMatrix fixed = fixedKernel(numParity);
+            if (fixed)
+            {
+                // the whole thing in one go
+                const uint8_t * mult[GFK_MAX_FIXED];
+                for (int row = 0; row < numParity; row++)
+                {
+                    for (int col = 0; col < numData; col++)
+                    {
+                        mult[(row * numData) + col] =
+                            gfa.multRow(d[numData + row][col]);
+                    }
+                }
+                fixed(data + numData, data, mult, len);
+                return;
+            }
+            // process the parity bytes one at a time
+            for (int row = numData; row < (numData + numParity); row++)
+            {
+                // clear the row corresponding to the parity bytes,
+                // the rows needn't abut if the caller owns the buffers
+                memset(data[row], 0, len);
+                // cycle through each data bit for each parity bit
+                for (int col = 0; col < numData; col++)
+                {
+                    // row and col are fixed, leave the bytes to the kernel
+                    kernel->mulAdd(data[row], data[col],
+                                   gfa.multRow(d[row][col]), len);
+                }
+            }
+        }
+
+    // calculate the parity for a single block of data
+    inline void parity(uint8_t * data) const
+        {
+            // output = matrix * data
+            // the first numData elements of output are just the data
+            // which is kind of boring, so let's just do the last bit
+            uint8_t * parity = data + numData;
+            for (int row = numData; row < (numData + numParity); row++)
+            {
+                *parity = 0;
+                for (int col = 0; col < numData; col++)
+                {
+                    *parity ^= gfa.mult(data[col], d[row][col]);
+                }
+                parity++;
+            }
+        }
+
+    // mark a data (or parity) set as failed.
+    void failData(uint8_t idx)
+        {
+            assert(idx < (numData + numParity));
+            d[idx][numData] = -1;
+        }
+    void failParity(uint8_t idx)
+        {
+            failData(idx + numData);
+        }
+    bool failed(uint8_t idx) const
+        {
+            // -1 == failed
+            if (d[idx][numData] == (uint8_t)-1) return true;
+            // must be -1 or 0 ...
+            assert(!d[idx][numData]);
+            return false;
+        }
+
+
+    // print out the D matrix
+    void print(const char * msg,
+               std::ostream & os = std::cerr) const
+        {
+            print(msg, d, numData + numParity, numData, os);
+        }
+
+    // print out a given matrix
+    static void print(const char * msg,
+                      uint8_t ** m,
+                      uint8_t rows,
+                      uint8_t cols,
+                      std::ostream & os = std::cerr)
+        {
+            if (!os) return;
+            os << msg << '\n';
+            for (int row = 0; row < rows; row++)
+            {
+                for (int col = 0; col < cols; col++)
+                {
+                    os << '\t' << (int)m[row][col];
+                }
+                os << '\n';
+            }
+            os << std::endl;
+        }
+
+    // generate the recovery matrix for the rows marked by failData()
+    uint8_t ** recovery() const
+        {
+            bool lost[256];
+            for (int row = 0; row < (numData + numParity); row++)
+            {
+                lost[row] = failed(row);
+            }
+            return recovery(lost);
+        }
+
+    // generate the recovery matrix for a given set of lost rows,
+    // lost[0 .. numData+numParity-1].
+    // Doesn't touch the GFM, so any number of these can be built
+    // concurrently from the one instance.
+    // Returns 0 if there aren't enough rows left (or no memory).
+    uint8_t ** recovery(const bool * lost) const
+        {
+// print numData+1 cols            print("Remaining", dumpFile);
+
+            // create an array to hold the recovery matrix
+            uint8_t ** ret = makeArray(numData, numData + 1);
+            if (!ret)
+            {
+                return 0;
+            }
+            // the rows to invert with an identity matrix alongside,
+            // [A | I], which row operations turn into [I | A^-1].
+            // Up to 125K, too much for the stack of a caller's thread.
+            uint8_t ** aug = makeArray(numData, 2 * numData);
+            if (!aug)
+            {
+                free(ret);
+                return 0;
+            }
+
+            // when replacing a failed row, start at the end of the matrix
+            uint8_t tst = numData + numParity;
+            // fill in the aug matrix from the available rows
+            for (int row = 0; row < numData; row++)
+            {
+                // assume the row has not failed (i.e. just copy it)
+                uint8_t cpy = row;
+                // if the row has failed ...
+                if (lost[cpy])
+                {
+                    // search for a non-failed row to replace it
+                    do
+                    {
+                        // make sure we haven't run out of redundancy..
+                        if (tst <= numData)
+                        {
+                            free(aug);
+                            free(ret);
+                            return 0;
+                        }
+                    } while (lost[--tst]);
+                    cpy = tst;
+                }
+                // copy the row
+                memcpy(aug[row], d[cpy], numData * sizeof(uint8_t));
+                aug[row][numData + row] = 1;
+                ret[row][numData] = cpy;
+            }
+
+            if (dump) print("Recovery", aug, numData, numData, *dump);
+
+            // OK.... now I have to do a gaussian elimination
+            if (!invert(aug))
+            {
+                // singular, shouldn't happen with this matrix
+                free(aug);
+                free(ret);
+                return 0;
+            }
+            for (int row = 0; row < numData; row++)
+            {
+                memcpy(ret[row], aug[row] + numData, numData);
+            }
+            free(aug);
+
+            if (dump) print("Inverse", ret, numData, numData, *dump);
+
+#ifndef NDEBUG
+            // OK.... now if we got that right then
+            // A * ret = I, one row at a time
+            for (int row = 0; row < numData; row++)
+            {
+                uint8_t chk[250] = {0,};
+                const uint8_t * a = d[ret[row][numData]];
+                for (int idx = 0; idx < numData; idx++)
+                {
+                    if (!a[idx]) continue;
+                    kernel->mulAdd(chk, ret[idx], gfa.multRow(a[idx]), numData);
+                }
+                for (int col = 0; col < numData; col++)
+                {
+                    assert(chk[col] == ((row == col) ? 1 : 0));
+                }
+            }
+#endif
+            return ret;
+        }
+
+    // recover a block of data.
+    // Only the lost rows flagged in wanted[0 .. numData-1] (if given)
+    // are rebuilt, and only the rows needed() says are read, so
+    // the others may be junk (or 0).
+    inline void recover(uint8_t * const * data, uint8_t ** r, size_t len,
+                        const bool * wanted = 0) const
+        {
+            // the rows to be recovered
+            uint8_t lost[256];
+            unsigned numLost = 0;
+            for (uint8_t row = 0; row < numData; row++)
+            {
+                if ((r[row][numData] != row) && (!wanted || wanted[row]))
+                {
+                    lost[numLost++] = row;
+                }
+            }
+            if (!numLost)
+            {
+                return;
+            }
+            GFKMatrix fixed = fixedKernel(numLost);
+            if (fixed)
+            {
+                uint8_t * out[256];
+                const uint8_t * in[256];
+                const uint8_t * mult[GFK_MAX_FIXED];
+                bool used[256] = {false,};
+                for (unsigned idx = 0; idx < numLost; idx++)
+                {
+                    out[idx] = data[lost[idx]];
+                    for (uint8_t col = 0; col < numData; col++)
+                    {
+                        uint8_t c = r[lost[idx]][col];
+                        mult[(idx * numData) + col] = gfa.multRow(c);
+                        used[col] |= c;
+                    }
+                }
+                for (uint8_t col = 0; col < numData; col++)
+                {
+                    in[col] = data[r[col][numData]];
+                    // the fixed kernel reads every input, but this
+                    // one mightn't have been
+                    if (!used[col]) fixed = 0;
+                }
+                if (fixed)
+                {
+                    fixed(out, in, mult, len);
+                    return;
+                }
+            }
+            for (unsigned idx = 0; idx < numLost; idx++)
+            {
+                uint8_t row = lost[idx];
+                // nuke whatever junk there may be
+                memset(data[row], 0, len);
+                for (uint8_t col = 0; col < numData; col++)
+                {
+                    // nothing to add, and the row mightn't be there
+                    if (!r[row][col]) continue;
+                    // row and col are constant now,
+                    // leave the bytes to the kernel
+                    kernel->mulAdd(data[row], data[r[col][numData]],
+                                   gfa.multRow(r[row][col]), len);
+                }
+            }
+        }
+
+    // the rows recover(data, r, len, wanted) will read,
+    // need[0 .. numData+numParity-1]: the wanted rows that are
+    // there and whatever the wanted lost ones are rebuilt from.
+    void needed(uint8_t ** r, const bool * wanted, bool * need) const
+        {
+            memset(need, 0, (numData + numParity) * sizeof(bool));
+            for (uint8_t row = 0; row < numData; row++)
+            {
+                if (wanted && !wanted[row]) continue;
+                if (r[row][numData] == row)
+                {
+                    need[row] = true;
+                    continue;
+                }
+                for (uint8_t col = 0; col < numData; col++)
+                {
+                    if (r[row][col]) need[r[col][numData]] = true;
+                }
+            }
+        }
+
+    // recover a single dataset
+    inline void recover(uint8_t * data, uint8_t ** r) const
+        {
+            for (uint8_t row = 0; row < numData; row++)
+            {
+                uint8_t tmp = 0;
+                for (uint8_t col = 0; col < numData; col++)
+                {
+                    tmp ^= gfa.mult(r[row][col],
+                                    data[r[col][numData]]);
+                }
+                data[row] = tmp;
+            }
+        }
+
+    // buff[0 .. len-1] all zero? The parity of zeros is zeros.
+    bool isZero(const uint8_t * buff, size_t len) const
+        {
+            return kernel->isZero(buff, len);
+        }
+
+    // dst ^= src, for the len bytes of them
+    void addRow(uint8_t * dst, const uint8_t * src, size_t len) const
+        {
+            kernel->mulAdd(dst, src, gfa.multRow(1), len);
+        }
+
+    // row *= c, for the len bytes of it
+    void scaleRow(uint8_t * row, uint8_t c, size_t len) const
+        {
+            uint8_t tmp[2 * 256];
+            assert(len <= sizeof(tmp));
+            memset(tmp, 0, len);
+            kernel->mulAdd(tmp, row, gfa.multRow(c), len);
+            memcpy(row, tmp, len);
+        }
+
+private:
+    // Gauss-Jordan on [A | I], the numData x (2 * numData) rows of
+    // 'aug', leaving [I | A^-1]. Each step is a whole-row mulAdd()
+    // on the kernel, from the pivot column on. Returns false if A is
+    // singular.
+    bool invert(uint8_t ** aug) const
+        {
+            const int width = 2 * numData;
+            for (int col = 0; col < numData; col++)
+            {
+                // a pivot, swapping rows if there's a 0 in the way
+                int p = col;
+                while ((p < numData) && !aug[p][col])
+                {
+                    p++;
+                }
+                if (p == numData)
+                {
+                    return false;
+                }
+                std::swap(aug[p], aug[col]);
+                // scale to 1, everything left of col is 0
+                scaleRow(aug[col] + col, gfa.div(1, aug[col][col]),
+                         width - col);
+                // take multiples of the pivot row away from the others
+                const uint8_t * pivot = aug[col] + col;
+                for (int row = 0; row < numData; row++)
+                {
+                    uint8_t mult = aug[row][col];
+                    if ((row == col) || !mult) continue;
+                    kernel->mulAdd(aug[row] + col, pivot,
+                                   gfa.multRow(mult), width - col);
+                }
+            }
+            return true;
+        }
+
+private:
+    GFA        gfa;
+    const GFK * kernel;
+    bool       useFixed;
+    std::ostream * dump;
+    uint8_t ** d;
+    uint8_t numData;
+    uint8_t numParity;
+
+
+public:
+    // fill the data rows with deterministic junk
+    static void fill(uint8_t * const * data, uint8_t rows, size_t len)
+        {
+            for (uint8_t rowIdx = 0; rowIdx < rows; rowIdx++)
+            {
+                uint8_t * row = data[rowIdx];
+                for (size_t idx = 0; idx < len; idx++)
+                {
+                    row[idx] = (uint8_t)(idx * (rowIdx^idx));
+                }
+            }
+        }
+
+    // is the junk still there?
+    static bool check(uint8_t * const * data, uint8_t rows, size_t len)
+        {
+            for (uint8_t rowIdx = 0; rowIdx < rows; rowIdx++)
+            {
+                uint8_t * row = data[rowIdx];
+                for (size_t idx = 0; idx < len; idx++)
+                {
+                    if (row[idx] != (uint8_t)(idx * (rowIdx^idx)))
+                    {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+    // built-in test
+    static void BIT()
+        {
+            // test 25 data blocks (64K each) with 25 parity blocks
+            const uint8_t numData   = 25;
+            const uint8_t numParity = 25;
+            const size_t blockSize  = 64 * 1024;
+
+            GFM gfm(numData, numParity);
+
+            // run the GFA built-in-test
+            gfm.gfa.BIT();
+
+            // single row test (redundant?)
+            uint8_t data[(numData+numParity)] = {55, 42, 69};
+
+            // matrix test
+            uint8_t ** data2 = gfm.makeArray(numData + numParity, blockSize);
+            // fill the matrix with deterministic junk
+            fill(data2, numData, blockSize);
+
+            // generate the parity data
+            gfm.parity(data);
+            gfm.parity(data2, blockSize);
+
+            // fail a bunch of rows
+#define FAIL_DATA(x) {gfm.failData(x); data[x] = -2;}
+            FAIL_DATA(9);
+            FAIL_DATA(1);
+            FAIL_DATA(2);
+            FAIL_DATA(3);
+            FAIL_DATA(4);
+            FAIL_DATA(5);
+            FAIL_DATA(6);
+            FAIL_DATA(7);
+#undef FAIL_DATA
+
+            // generate a recovery matrix
+            uint8_t ** r = gfm.recovery();
+
+            // recover ...
+            gfm.recover(data, r);
+            gfm.recover(data2, r, blockSize);
+
+            // test the junk
+            assert(check(data2, numData, blockSize));
+
+            // only some of the lost rows wanted: those come back, the
+            // rest are left alone and unneeded rows aren't even read
+            {
+                bool wanted[numData] = {false,};
+                wanted[0] = wanted[3] = wanted[9] = wanted[10] = true;
+                bool need[numData + numParity];
+                gfm.needed(r, wanted, need);
+                assert(need[0] && need[10] && !need[3] && !need[9]);
+                uint8_t * rows[numData + numParity];
+                for (int row = 0; row < (numData + numParity); row++)
+                {
+                    rows[row] = need[row] ? data2[row] : 0;
+                }
+                rows[3] = data2[3];
+                rows[9] = data2[9];
+                memset(data2[3], 0, blockSize);
+                memset(data2[9], 0, blockSize);
+                memset(data2[5], 0x55, blockSize);
+                gfm.recover(rows, r, blockSize, wanted);
+                assert(data2[5][0] == 0x55);
+                // all of it again, for row 5
+                gfm.recover(data2, r, blockSize);
+                assert(check(data2, numData, blockSize));
+            }
+
+            // every kernel must agree with the lookup table,
+            // odd length to catch the leftovers
+            for (const GFK * k = gfKernels; k->name; k++)
+            {
+                if (!k->supported()) continue;
+                for (int c = 0; c < 256; c++)
+                {
+                    uint8_t src[259];
+                    uint8_t dst[259];
+                    for (size_t idx = 0; idx < sizeof(src); idx++)
+                    {
+                        src[idx] = idx;
+                        dst[idx] = idx * 7;
+                    }
+                    k->mulAdd(dst, src, gfm.gfa.multRow(c), sizeof(src));
+                    for (size_t idx = 0; idx < sizeof(src); idx++)
+                    {
+                        assert(dst[idx] ==
+                               ((uint8_t)(idx * 7) ^ gfm.gfa.mult(c, src[idx])));
+                    }
+                }
+
+                // ... and a stray bit anywhere must count
+                uint8_t zero[1031] = {0,};
+                assert(k->isZero(zero, sizeof(zero)));
+                assert(k->isZero(zero, 0));
+                for (size_t idx = 0; idx < sizeof(zero); idx++)
+                {
+                    zero[idx] = 1 << (idx % 8);
+                    assert(!k->isZero(zero, sizeof(zero)));
+                    assert(k->isZero(zero, idx));
+                    zero[idx] = 0;
+                }
+            }
+
+            free(r);
+            free(data2);
+
+            // the fixed geometries must match the generic loops,
+            // for parity and for losing 1 .. numParity data rows
+            for (int g = 0; gfGeometries[g][0]; g++)
+            {
+                const uint8_t n = gfGeometries[g][0];
+                const uint8_t m = gfGeometries[g][1];
+                // odd length, to catch the leftovers
+                const size_t len = 4099;
+                GFM fixed(n, m);
+                GFM generic(n, m);
+                generic.setFixed(false);
+                uint8_t ** a = makeArray(n + m, len);
+                uint8_t ** b = makeArray(n + m, len);
+                fill(a, n, len);
+                fill(b, n, len);
+                for (const GFK * k = gfKernels; k->name; k++)
+                {
+                    if (!k->supported()) continue;
+                    fixed.kernel = k;
+                    generic.kernel = k;
+                    fixed.parity(a, len);
+                    generic.parity(b, len);
+                    assert(!memcmp(a[0], b[0], (n + m) * len));
+
+                    for (uint8_t e = 1; (e <= m) && (e <= n); e++)
+                    {
+                        bool lost[256] = {false,};
+                        for (uint8_t row = 0; row < e; row++)
+                        {
+                            // every other row, if there's room
+                            lost[(row * 2) % n] = true;
+                        }
+                        uint8_t ** r = fixed.recovery(lost);
+                        assert(r);
+                        for (uint8_t row = 0; row < n; row++)
+                        {
+                            if (!lost[row]) continue;
+                            memset(a[row], 0xa5, len);
+                            memset(b[row], 0x5a, len);
+                        }
+                        fixed.recover(a, r, len);
+                        generic.recover(b, r, len);
+                        assert(check(a, n, len));
+                        assert(check(b, n, len));
+                        free(r);
+                    }
+                }
+                free(a);
+                free(b);
+            }
+
+            // the padding comes off again, whatever length the stripe
+            {
+                uint8_t buff[264];
+                for (size_t size = 256; size < sizeof(buff); size++)
+                {
+                    const size_t reads[] = {0, 1, size - 129, size - 128,
+                                            size - 127, size - 2, size - 1};
+                    for (size_t r = 0; r < (sizeof(reads) / sizeof(reads[0])); r++)
+                    {
+                        memset(buff, 0xee, sizeof(buff));
+                        addPadding(buff, reads[r], size - 1);
+                        assert(removePadding(buff, size) == reads[r]);
+                    }
+                }
+            }
+        };
+};
+
+// as the C gfm_codec_create_lrc() (see libgfm.h), but the matrices
+// are dumped to 'dump' as the codec and its decoders are built.
+struct gfm_codec;
+int gfm_codec_create(gfm_codec ** codec,
+                     unsigned numData,
+                     unsigned numParity,
+                     std::ostream * dump,
+                     unsigned numGroups = 0);
+
+#endif // GFM_HH
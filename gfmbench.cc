@@ -0,0 +1,359 @@
+#include "gfm.hh"
+#include "timer.hh"
+
+#include <algorithm>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+/**
+   gfmbench: the micro benchmarks behind 'make bench'.
+
+   Prints one "name,value,unit,noise" line per test. Every value is a
+   rate, bigger is better, so two runs can be compared with benchcmp.
+   One run of a test on its own is mostly noise (whatever else the
+   machine is up to, frequency scaling, ...) so the lot is run
+   several times over and each test's best is what's printed, with
+   how far below it the median was, in percent.
+*/
+
+// how long to keep each test going for, seconds
+static double minTime = 0.2;
+// how many rounds of all of them
+static unsigned rounds = 5;
+
+// same as the one in gfm.cc
+static void attest(bool test, const char * epilogue = "oops", ...)
+{
+    if (test)
+    {
+        return;
+    }
+    va_list ap;
+    va_start(ap, epilogue);
+    vfprintf(stderr, epilogue, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    exit(1);
+}
+
+// call fn() for at least minTime, return calls per second
+template <typename F>
+static double Rate(F fn)
+{
+    // once to warm the caches up
+    fn();
+    uint64_t calls = 0;
+    uint64_t t0 = now();
+    uint64_t elapsed = 0;
+    do
+    {
+        fn();
+        calls++;
+        elapsed = now() - t0;
+    } while (elapsed < (minTime * 1e9));
+    return calls * 1e9 / elapsed;
+}
+
+// the best so far of each test, in the order they first ran
+struct Result
+{
+    std::string  name;
+    std::vector<double> values;
+    const char * unit;
+};
+static std::vector<Result> results;
+
+static void Report(const std::string & name, double value, const char * unit)
+{
+    for (size_t idx = 0; idx < results.size(); idx++)
+    {
+        if (results[idx].name == name)
+        {
+            results[idx].values.push_back(value);
+            return;
+        }
+    }
+    Result r = {name, std::vector<double>(1, value), unit};
+    results.push_back(r);
+}
+
+static std::string Geometry(unsigned numData, unsigned numParity)
+{
+    char buff[32];
+    snprintf(buff, sizeof(buff), "%u+%u", numData, numParity);
+    return buff;
+}
+
+// GFA::mult() one byte at a time versus the kernels
+static void BenchMult()
+{
+    const size_t len = 64 * 1024;
+    uint8_t * src = (uint8_t *)malloc(len);
+    uint8_t * dst = (uint8_t *)calloc(len, 1);
+    attest(src && dst, "Unable to allocate %zu bytes", len);
+    for (size_t idx = 0; idx < len; idx++)
+    {
+        src[idx] = idx * 13;
+    }
+
+    GFA gfa;
+    const uint8_t c = 0x8e;
+    double rate = Rate([&]()
+    {
+        for (size_t idx = 0; idx < len; idx++)
+        {
+            dst[idx] ^= gfa.mult(src[idx], c);
+        }
+    });
+    Report("mult/GFA::mult", rate * len / 1e6, "MB/s");
+
+    for (const GFK * k = gfKernels; k->name; k++)
+    {
+        if (!k->supported()) continue;
+        rate = Rate([&]()
+        {
+            k->mulAdd(dst, src, gfa.multRow(c), len);
+        });
+        Report(std::string("mult/") + k->name, rate * len / 1e6, "MB/s");
+    }
+    free(src);
+    free(dst);
+}
+
+// GFM::parity() and GFM::recover() on one stripe, best kernel.
+// 'generic' turns off the fixed geometry kernels, "-generic" is
+// appended to the names.
+static void BenchStripe(unsigned numData, unsigned numParity,
+                        bool generic = false)
+{
+    const size_t blockSize = 64 * 1024;
+    GFM gfm(numData, numParity);
+    attest(gfm.good(), "Unable to create %u + %u GFM", numData, numParity);
+    gfm.setFixed(!generic);
+    const std::string suffix = generic ? "-generic/" : "/";
+    uint8_t ** data = GFM::makeArray(numData + numParity, blockSize);
+    attest(data, "Unable to create %u x %zu matrix",
+           numData + numParity, blockSize);
+    GFM::fill(data, numData, blockSize);
+
+    const double bytes = numData * blockSize;
+    double rate = Rate([&]()
+    {
+        gfm.parity(data, blockSize);
+    });
+    Report("parity" + suffix + Geometry(numData, numParity), rate * bytes / 1e6, "MB/s");
+
+    // as many data rows as can be lost
+    bool lost[256] = {false,};
+    for (unsigned idx = 0; (idx < numParity) && (idx < numData); idx++)
+    {
+        lost[idx] = true;
+    }
+    uint8_t ** r = gfm.recovery(lost);
+    attest(r, "Unable to create %u + %u recovery matrix", numData, numParity);
+    rate = Rate([&]()
+    {
+        gfm.recover(data, r, blockSize);
+    });
+    Report("recover" + suffix + Geometry(numData, numParity), rate * bytes / 1e6, "MB/s");
+    attest(GFM::check(data, numData, blockSize),
+           "%u + %u: recover mismatch", numData, numParity);
+
+    free(r);
+    free(data);
+}
+
+// GFM::recovery(), i.e. the matrix inversion
+static void BenchRecovery(unsigned numData, unsigned numParity)
+{
+    GFM gfm(numData, numParity);
+    attest(gfm.good(), "Unable to create %u + %u GFM", numData, numParity);
+    bool lost[256] = {false,};
+    for (unsigned idx = 0; (idx < numParity) && (idx < numData); idx++)
+    {
+        lost[idx] = true;
+    }
+    double rate = Rate([&]()
+    {
+        uint8_t ** r = gfm.recovery(lost);
+        attest(r, "Unable to create %u + %u recovery matrix",
+               numData, numParity);
+        free(r);
+    });
+    Report("recovery/" + Geometry(numData, numParity), rate, "op/s");
+}
+
+// building a GFM, i.e. what a codec costs to set up
+static void BenchCreate(unsigned numData, unsigned numParity)
+{
+    double rate = Rate([&]()
+    {
+        GFM gfm(numData, numParity);
+        attest(gfm.good(), "Unable to create %u + %u GFM", numData, numParity);
+    });
+    Report("create/" + Geometry(numData, numParity), rate, "op/s");
+}
+
+// addPadding()/removePadding() on a 10 x 4K stripe,
+// full, a few bytes short and a lot short.
+static void BenchPadding()
+{
+    const size_t size = 10 * 4096;
+    uint8_t * buff = (uint8_t *)calloc(size, 1);
+    attest(buff, "Unable to allocate %zu bytes", size);
+    const ssize_t numRead[] = {size - 1, size - 100, size / 3};
+    size_t sum = 0;
+    double rate = Rate([&]()
+    {
+        for (int idx = 0; idx < 3; idx++)
+        {
+            addPadding(buff, numRead[idx], size - 1);
+            sum += removePadding(buff, size);
+        }
+    });
+    attest(sum, "removePadding() never removed anything?");
+    Report("padding", rate * 3 / 1e6, "Mop/s");
+    free(buff);
+}
+
+// the gfm tool on a tmpfs, so mostly CPU, pipes and checksums
+static void BenchEndToEnd(const char * gfm,
+                          const char * tmp,
+                          size_t size,
+                          unsigned numData,
+                          unsigned numParity)
+{
+    if (access(gfm, X_OK))
+    {
+        fprintf(stderr, "skipping end to end, no '%s'\n", gfm);
+        return;
+    }
+    std::string dir = std::string(tmp) + "/gfmbench.XXXXXX";
+    attest(mkdtemp(&dir[0]), "Unable to create directory in '%s'", tmp);
+    std::string in = dir + "/in";
+    std::string stub = dir + "/x";
+
+    FILE * file = fopen(in.c_str(), "w");
+    attest(file, "Unable to create '%s'", in.c_str());
+    uint32_t x = 1;
+    for (size_t idx = 0; idx < size; idx += sizeof(x))
+    {
+        // xorshift, cheap and doesn't compress
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        fwrite(&x, sizeof(x), 1, file);
+    }
+    fclose(file);
+
+    char cmd[4096];
+    const std::string name = Geometry(numData, numParity);
+
+    snprintf(cmd, sizeof(cmd), "%s %s %u %u < %s",
+             gfm, stub.c_str(), numData, numParity, in.c_str());
+    uint64_t t0 = now();
+    attest(!system(cmd), "failed: %s", cmd);
+    Report("e2e/encode/" + name, size * 1e3 / (now() - t0), "MB/s");
+
+    // lose the first numParity data files
+    for (unsigned idx = 0; (idx < numParity) && (idx < numData); idx++)
+    {
+        snprintf(cmd, sizeof(cmd), "%s%02x", stub.c_str(), idx);
+        unlink(cmd);
+    }
+    snprintf(cmd, sizeof(cmd), "%s %s | cmp -s - %s",
+             gfm, stub.c_str(), in.c_str());
+    t0 = now();
+    attest(!system(cmd), "failed: %s", cmd);
+    Report("e2e/recover/" + name, size * 1e3 / (now() - t0), "MB/s");
+
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir.c_str());
+    attest(!system(cmd), "failed: %s", cmd);
+}
+
+static void Usage(const char * prog)
+{
+    fprintf(stderr,
+            "%s [--time=SECONDS] [--rounds=N] [--gfm=PATH] [--tmp=DIR] [--size=MiB]\n"
+            "\t--time  minimum time per test (%.2f)\n"
+            "\t--rounds  times to run them all, the best is printed (%u)\n"
+            "\t--gfm   gfm binary for the end to end test (./gfm)\n"
+            "\t--tmp   where to put its files (/dev/shm)\n"
+            "\t--size  end to end input size (64)\n",
+            prog, minTime, rounds);
+    exit(1);
+}
+
+int main(int argc, char ** argv)
+{
+    const char * gfm = "./gfm";
+    const char * tmp = "/dev/shm";
+    size_t size = 64 << 20;
+
+    for (int idx = 1; idx < argc; idx++)
+    {
+        const char * arg = argv[idx];
+        const char * val = strchr(arg, '=');
+        val = val ? val + 1 : "";
+
+        if      (!strncmp(arg, "--time=", 7)) minTime = atof(val);
+        else if (!strncmp(arg, "--rounds=", 9)) rounds = std::max(1, atoi(val));
+        else if (!strncmp(arg, "--gfm=", 6))  gfm = val;
+        else if (!strncmp(arg, "--tmp=", 6))  tmp = val;
+        else if (!strncmp(arg, "--size=", 7)) size = strtoul(val, 0, 0) << 20;
+        else Usage(argv[0]);
+    }
+    if (access(tmp, W_OK))
+    {
+        tmp = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    }
+
+    for (unsigned round = 0; round < rounds; round++)
+    {
+        fprintf(stderr, "round %u of %u\n", round + 1, rounds);
+        BenchMult();
+
+        const unsigned geometry[][2] = {{4, 2}, {10, 4}, {20, 10}};
+        for (unsigned idx = 0; idx < 3; idx++)
+        {
+            BenchStripe(geometry[idx][0], geometry[idx][1]);
+        }
+        // what the fixed kernels buy
+        for (unsigned idx = 0; gfGeometries[idx][0]; idx++)
+        {
+            if ((gfGeometries[idx][0] != 10) || (gfGeometries[idx][1] != 4))
+            {
+                BenchStripe(gfGeometries[idx][0], gfGeometries[idx][1]);
+            }
+            BenchStripe(gfGeometries[idx][0], gfGeometries[idx][1], true);
+        }
+
+        const unsigned sizes[][2] = {{4, 2}, {16, 8}, {64, 32}, {128, 64}, {200, 50}};
+        for (unsigned idx = 0; idx < 5; idx++)
+        {
+            BenchRecovery(sizes[idx][0], sizes[idx][1]);
+        }
+
+        BenchCreate(10, 4);
+        BenchPadding();
+
+        BenchEndToEnd(gfm, tmp, size, 10, 4);
+    }
+
+    printf("# name,value,unit,noise\n");
+    for (size_t idx = 0; idx < results.size(); idx++)
+    {
+        Result & r = results[idx];
+        std::sort(r.values.begin(), r.values.end());
+        const double best   = r.values.back();
+        const double median = r.values[r.values.size() / 2];
+        printf("%s,%.1f,%s,%.1f\n", r.name.c_str(), best, r.unit,
+               (best > 0) ? ((best - median) * 100 / best) : 0);
+    }
+    return 0;
+}
@@ -0,0 +1 @@
+#define GIT_TAG "gfm-"
@@ -0,0 +1,460 @@
+#include "libgfm.h"
+#include "gfm.hh"
+#include "probes.hh"
+
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+struct gfm_codec
+{
+    gfm_codec(uint8_t numData, uint8_t numParity, std::ostream * dump,
+              uint8_t _numGroups)
+        : gfm(numData, numParity, dump)
+        , numGroups(_numGroups)
+        {
+            memset(groupStart, 0, sizeof(groupStart));
+            memset(groupEnd,   0, sizeof(groupEnd));
+            memset(group,      0, sizeof(group));
+            // as even as they go, the first ones get any extra
+            for (unsigned g = 0, idx = 0; g < numGroups; g++)
+            {
+                groupStart[g] = idx;
+                idx += (numData / numGroups) + (g < (numData % numGroups));
+                groupEnd[g] = idx;
+                for (unsigned d = groupStart[g]; d < groupEnd[g]; d++)
+                {
+                    group[d] = g;
+                }
+            }
+        }
+
+    unsigned shards() const
+        {
+            return gfm.dataRows() + gfm.parityRows() + numGroups;
+        }
+
+    // the local parity shard of group 'g'
+    unsigned localParity(unsigned g) const
+        {
+            return gfm.dataRows() + gfm.parityRows() + g;
+        }
+
+    GFM gfm;
+    // local groups, data shards [groupStart[g], groupEnd[g])
+    uint8_t numGroups;
+    uint8_t groupStart[GFM_MAX_SHARDS];
+    uint8_t groupEnd[GFM_MAX_SHARDS];
+    uint8_t group[GFM_MAX_SHARDS];
+};
+
+struct gfm_decoder
+{
+    const gfm_codec * codec;
+    // recovery matrix, see GFM::recovery()
+    uint8_t ** rcvr;
+    // the data shards to rebuild, 0 for all of them
+    bool * wanted;
+    bool   wantedRows[GFM_MAX_SHARDS];
+    // data shards rebuilt from their local group, before rcvr
+    unsigned numLocal;
+    uint8_t  local[GFM_MAX_SHARDS];
+};
+
+// the 32-bit shortfall is this many bytes from the end of the stripe,
+// where it's always been for stripes a multiple of 4 long
+static const size_t PADDING_AT = 12;
+
+void addPadding(uint8_t * buff, ssize_t numRead, ssize_t expected)
+{
+    // is the buffer full?
+    if (numRead == expected)
+    {
+        // no need to add padding!
+        buff[expected] = 0;
+        return;
+    }
+    // how many bytes are missing?
+    ssize_t missing = (expected - numRead);
+    // sanity check.....
+    assert(missing > 0);
+
+    // flag the block as being short
+    // missing fewer than 0x80 (128) bytes?
+    if (missing < 0x80)
+    {
+        // just use the last byte to store the shortfall
+        buff[expected] = (uint8_t)(missing & 0xFF);
+        return;
+    }
+    // use a 32-bit int to store the shortfall
+    buff[expected] = 0x80;
+    const uint32_t shortfall = missing;
+    memcpy(buff + expected + 1 - PADDING_AT, &shortfall, sizeof(shortfall));
+}
+
+size_t removePadding(uint8_t * buff, size_t buffSize)
+{
+    uint8_t flag = buff[--buffSize];
+    // block full?
+    if (flag == 0)
+    {
+        // no padding to remove
+//        DMP(buffSize);
+        return buffSize;
+    }
+
+    // block missing < 128 bytes?
+    if (flag < 0x80)
+    {
+//        DMP(buffSize - flag);
+        return buffSize - flag;
+    }
+
+    // missing lots!
+    uint32_t missing = 0;
+    memcpy(&missing, buff + buffSize + 1 - PADDING_AT, sizeof(missing));
+    buffSize -= missing;
+//    DMP(missing);
+//    DMP(buffSize);
+    return buffSize;
+}
+
+const char * gfm_strerror(int rc)
+{
+    switch (rc)
+    {
+    case GFM_OK:        return "OK";
+    case GFM_EINVAL:    return "invalid argument";
+    case GFM_ENOMEM:    return "out of memory";
+    case GFM_ETOOFEW:   return "not enough shards to recover";
+    case GFM_ESINGULAR: return "recovery matrix is singular";
+    }
+    return "unknown error";
+}
+
+int gfm_codec_create(gfm_codec ** codec,
+                     unsigned numData,
+                     unsigned numParity)
+{
+    return gfm_codec_create(codec, numData, numParity, 0);
+}
+
+int gfm_codec_create_lrc(gfm_codec ** codec,
+                         unsigned numData,
+                         unsigned numParity,
+                         unsigned numGroups)
+{
+    return gfm_codec_create(codec, numData, numParity, 0, numGroups);
+}
+
+int gfm_codec_create(gfm_codec ** codec,
+                     unsigned numData,
+                     unsigned numParity,
+                     std::ostream * dump,
+                     unsigned numGroups)
+{
+    if (!codec ||
+        !numData || !numParity || (numGroups > numData) ||
+        ((numData + numParity + numGroups) > GFM_MAX_SHARDS))
+    {
+        return GFM_EINVAL;
+    }
+    gfm_codec * ret = new (std::nothrow) gfm_codec(numData, numParity, dump,
+                                                   numGroups);
+    if (!ret || !ret->gfm.good())
+    {
+        delete ret;
+        return GFM_ENOMEM;
+    }
+    *codec = ret;
+    return GFM_OK;
+}
+
+void gfm_codec_destroy(gfm_codec * codec)
+{
+    delete codec;
+}
+
+unsigned gfm_codec_data(const gfm_codec * codec)
+{
+    return codec->gfm.dataRows();
+}
+
+unsigned gfm_codec_parity(const gfm_codec * codec)
+{
+    return codec->gfm.parityRows();
+}
+
+unsigned gfm_codec_groups(const gfm_codec * codec)
+{
+    return codec->numGroups;
+}
+
+unsigned gfm_codec_shards(const gfm_codec * codec)
+{
+    return codec->shards();
+}
+
+int gfm_codec_group_of(const gfm_codec * codec, unsigned idx)
+{
+    if (!codec || !codec->numGroups || (idx >= codec->gfm.dataRows()))
+    {
+        return GFM_EINVAL;
+    }
+    return codec->group[idx];
+}
+
+const char * gfm_kernel(unsigned idx)
+{
+    for (const GFK * k = gfKernels; k->name; k++)
+    {
+        if (k->supported() && !idx--)
+        {
+            return k->name;
+        }
+    }
+    return 0;
+}
+
+int gfm_codec_set_kernel(gfm_codec * codec, const char * name)
+{
+    if (!codec || !codec->gfm.setKernel(name))
+    {
+        return GFM_EINVAL;
+    }
+    return GFM_OK;
+}
+
+const char * gfm_codec_kernel(const gfm_codec * codec)
+{
+    return codec->gfm.kernelName();
+}
+
+int gfm_is_zero(const gfm_codec * codec, const uint8_t * buff, size_t len)
+{
+    if (!codec || (!buff && len))
+    {
+        return GFM_EINVAL;
+    }
+    return codec->gfm.isZero(buff, len);
+}
+
+int gfm_encode(const gfm_codec * codec,
+               uint8_t * const * shards,
+               size_t len)
+{
+    if (!codec || !shards)
+    {
+        return GFM_EINVAL;
+    }
+    codec->gfm.parity(shards, len);
+    // the local parity is the XOR of its group
+    for (unsigned g = 0; g < codec->numGroups; g++)
+    {
+        uint8_t * dst = shards[codec->localParity(g)];
+        memcpy(dst, shards[codec->groupStart[g]], len);
+        for (unsigned d = codec->groupStart[g] + 1; d < codec->groupEnd[g]; d++)
+        {
+            codec->gfm.addRow(dst, shards[d], len);
+        }
+    }
+    return GFM_OK;
+}
+
+int gfm_decoder_create(const gfm_codec * codec,
+                       const uint8_t * erased,
+                       gfm_decoder ** decoder)
+{
+    return gfm_decoder_create_partial(codec, erased, 0, decoder);
+}
+
+int gfm_decoder_create_partial(const gfm_codec * codec,
+                               const uint8_t * erased,
+                               const uint8_t * wanted,
+                               gfm_decoder ** decoder)
+{
+    if (!codec || !erased || !decoder)
+    {
+        return GFM_EINVAL;
+    }
+    const GFM & gfm = codec->gfm;
+    const int rows = gfm.dataRows() + gfm.parityRows();
+
+    gfm_decoder * ret = new (std::nothrow) gfm_decoder;
+    if (!ret)
+    {
+        return GFM_ENOMEM;
+    }
+    ret->codec  = codec;
+    ret->wanted = 0;
+    if (wanted)
+    {
+        ret->wanted = ret->wantedRows;
+        for (int idx = 0; idx < gfm.dataRows(); idx++)
+        {
+            ret->wantedRows[idx] = wanted[idx];
+        }
+    }
+
+    // Local repair first: any group missing just the one data shard
+    // (and not its local parity) gets it back by XOR. Only the wanted
+    // ones to start with, the rest if the global parity can't manage
+    // without them.
+    bool lost[GFM_MAX_SHARDS];
+    int numLost = 0;
+    for (bool all = !wanted; ; all = true)
+    {
+        ret->numLocal = 0;
+        numLost = 0;
+        for (int idx = 0; idx < rows; idx++)
+        {
+            lost[idx] = erased[idx];
+        }
+        for (unsigned g = 0; g < codec->numGroups; g++)
+        {
+            if (erased[codec->localParity(g)])
+            {
+                continue;
+            }
+            int missing = -1;
+            unsigned numMissing = 0;
+            for (unsigned d = codec->groupStart[g]; d < codec->groupEnd[g]; d++)
+            {
+                if (erased[d])
+                {
+                    missing = d;
+                    numMissing++;
+                }
+            }
+            if ((numMissing == 1) && (all || wanted[missing]))
+            {
+                ret->local[ret->numLocal++] = missing;
+                lost[missing] = false;
+            }
+        }
+        for (int idx = 0; idx < rows; idx++)
+        {
+            numLost += lost[idx];
+        }
+        if (all || (numLost <= gfm.parityRows()))
+        {
+            break;
+        }
+    }
+    if (numLost > gfm.parityRows())
+    {
+        delete ret;
+        return GFM_ETOOFEW;
+    }
+
+    PROBE3(recovery_start, gfm.dataRows(), gfm.parityRows(), numLost);
+    ret->rcvr  = gfm.recovery(lost);
+    PROBE3(recovery_done, gfm.dataRows(), gfm.parityRows(), ret->rcvr != 0);
+    if (!ret->rcvr)
+    {
+        delete ret;
+        // enough rows were left, so it wasn't for lack of redundancy
+        return GFM_ESINGULAR;
+    }
+    *decoder = ret;
+    return GFM_OK;
+}
+
+int gfm_decoder_needs(const gfm_decoder * decoder, uint8_t * needed)
+{
+    if (!decoder || !needed)
+    {
+        return GFM_EINVAL;
+    }
+    const gfm_codec * codec = decoder->codec;
+    const GFM & gfm = codec->gfm;
+    bool need[GFM_MAX_SHARDS];
+    gfm.needed(decoder->rcvr, decoder->wanted, need);
+    for (unsigned idx = 0; idx < codec->shards(); idx++)
+    {
+        needed[idx] = (idx < (unsigned)(gfm.dataRows() + gfm.parityRows()))
+            ? need[idx]
+            : 0;
+    }
+    // the locally repaired ones are rebuilt from the rest of the group
+    for (unsigned l = 0; l < decoder->numLocal; l++)
+    {
+        unsigned g = codec->group[decoder->local[l]];
+        for (unsigned d = codec->groupStart[g]; d < codec->groupEnd[g]; d++)
+        {
+            needed[d] = 1;
+        }
+        needed[decoder->local[l]] = 0;
+        needed[codec->localParity(g)] = 1;
+    }
+    return GFM_OK;
+}
+
+void gfm_decoder_destroy(gfm_decoder * decoder)
+{
+    if (!decoder)
+    {
+        return;
+    }
+    free(decoder->rcvr);
+    delete decoder;
+}
+
+int gfm_decode(const gfm_decoder * decoder,
+               uint8_t * const * shards,
+               size_t len)
+{
+    if (!decoder || !shards)
+    {
+        return GFM_EINVAL;
+    }
+    const gfm_codec * codec = decoder->codec;
+    for (unsigned l = 0; l < decoder->numLocal; l++)
+    {
+        unsigned row = decoder->local[l];
+        unsigned g   = codec->group[row];
+        memcpy(shards[row], shards[codec->localParity(g)], len);
+        for (unsigned d = codec->groupStart[g]; d < codec->groupEnd[g]; d++)
+        {
+            if (d != row) codec->gfm.addRow(shards[row], shards[d], len);
+        }
+    }
+    codec->gfm.recover(shards, decoder->rcvr, len, decoder->wanted);
+    return GFM_OK;
+}
+
+int gfm_pad(uint8_t * stripe, size_t numRead, size_t size)
+{
+    // room for the flag byte and the 32-bit shortfall
+    if (!stripe || (size < 16) || (numRead >= size))
+    {
+        return GFM_EINVAL;
+    }
+    addPadding(stripe, numRead, size - 1);
+    return GFM_OK;
+}
+
+ssize_t gfm_unpad(uint8_t * stripe, size_t size)
+{
+    if (!stripe || (size < 16))
+    {
+        return GFM_EINVAL;
+    }
+    // a flag or a shortfall of more than there is is damage
+    const uint8_t flag = stripe[size - 1];
+    uint32_t missing = flag;
+    if (flag == 0x80)
+    {
+        memcpy(&missing, stripe + size - PADDING_AT, sizeof(missing));
+        if (missing < 0x80)
+        {
+            return GFM_EINVAL;
+        }
+    }
+    if ((flag > 0x80) || (missing > (size - 1)))
+    {
+        return GFM_EINVAL;
+    }
+    return removePadding(stripe, size);
+}
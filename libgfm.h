@@ -0,0 +1,139 @@
+#ifndef LIBGFM_H
+#define LIBGFM_H
+
+/*
+  libgfm: the gfm Reed-Solomon codec, minus the files.
+
+  The caller owns every buffer. A stripe is numData + numParity
+  (+ numGroups, see gfm_codec_create_lrc()) shards of 'len' bytes
+  each, passed as an array of pointers. The shards needn't be
+  contiguous.
+
+  Nothing in here exits, prints or touches a file descriptor,
+  errors come back as one of the (negative) GFM_E* codes.
+  A codec is read-only once created, so any number of threads can
+  encode with it (and build decoders from it) at the same time.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum
+{
+    GFM_OK        =  0,
+    GFM_EINVAL    = -1, // bad geometry, NULL pointer, ...
+    GFM_ENOMEM    = -2, // out of memory
+    GFM_ETOOFEW   = -3, // fewer than numData shards available
+    GFM_ESINGULAR = -4, // recovery matrix could not be inverted
+};
+
+// maximum number of shards (data + parity) in a stripe
+#define GFM_MAX_SHARDS 250
+
+typedef struct gfm_codec   gfm_codec;
+typedef struct gfm_decoder gfm_decoder;
+
+// human readable version of a return code
+const char * gfm_strerror(int rc);
+
+// create a codec for numData data shards and numParity parity shards.
+// 1 <= numData, 1 <= numParity, numData + numParity <= GFM_MAX_SHARDS
+int  gfm_codec_create(gfm_codec ** codec,
+                      unsigned numData,
+                      unsigned numParity);
+void gfm_codec_destroy(gfm_codec * codec);
+
+// a locally repairable code: as above, plus the numData data shards
+// split into numGroups local groups (as evenly as they go) with an
+// XOR parity shard each. The stripe is then data, parity, local
+// parity: numData + numParity + numGroups shards. A single shard
+// lost from a group is rebuilt from the rest of the group alone,
+// the numParity (global) parity shards are for the rest.
+// numGroups of 0 is gfm_codec_create().
+int  gfm_codec_create_lrc(gfm_codec ** codec,
+                          unsigned numData,
+                          unsigned numParity,
+                          unsigned numGroups);
+
+unsigned gfm_codec_data(const gfm_codec * codec);
+unsigned gfm_codec_parity(const gfm_codec * codec);
+// local groups, 0 for a plain Reed-Solomon codec
+unsigned gfm_codec_groups(const gfm_codec * codec);
+// the shards in a stripe, numData + numParity + numGroups
+unsigned gfm_codec_shards(const gfm_codec * codec);
+// the local group data shard 'idx' is in, GFM_EINVAL if idx isn't
+// a data shard or the codec has no groups
+int  gfm_codec_group_of(const gfm_codec * codec, unsigned idx);
+
+// the GF multiply kernels this CPU can run, best first.
+// Returns 0 once idx runs off the end.
+const char * gfm_kernel(unsigned idx);
+// pick the kernel a codec uses, 0 for the best one (the default).
+// Not to be called while other threads are using the codec.
+int  gfm_codec_set_kernel(gfm_codec * codec, const char * name);
+const char * gfm_codec_kernel(const gfm_codec * codec);
+
+// 1 if buff[0 .. len-1] is all zeros, 0 if not, on the codec's
+// kernel. A stripe of zero data has zero parity, no need to encode
+// (or decode) it.
+int  gfm_is_zero(const gfm_codec * codec, const uint8_t * buff, size_t len);
+
+// calculate shards[numData .. gfm_codec_shards()-1]
+// from shards[0 .. numData-1]
+int  gfm_encode(const gfm_codec * codec,
+                uint8_t * const * shards,
+                size_t len);
+
+// build a decoder for a given set of erasures.
+// erased[0 .. gfm_codec_shards()-1] is non-zero for every missing shard.
+// With local groups, a group missing just the one data shard gets it
+// back from the rest of the group, the global parity only rebuilds
+// what's left.
+int  gfm_decoder_create(const gfm_codec * codec,
+                        const uint8_t * erased,
+                        gfm_decoder ** decoder);
+void gfm_decoder_destroy(gfm_decoder * decoder);
+
+// as gfm_decoder_create(), for when only some of the data is wanted.
+// wanted[0 .. numData-1] is non-zero for every data shard the caller
+// needs, gfm_decode() only rebuilds those (if they were erased),
+// which costs wanted rows x numData rather than erased x numData.
+int  gfm_decoder_create_partial(const gfm_codec * codec,
+                                const uint8_t * erased,
+                                const uint8_t * wanted,
+                                gfm_decoder ** decoder);
+
+// which shards gfm_decode() will read: needed[0 .. gfm_codec_shards()-1]
+// is set non-zero for the wanted shards that survive and for those
+// the wanted erased ones are rebuilt from. The rest needn't be read.
+int  gfm_decoder_needs(const gfm_decoder * decoder, uint8_t * needed);
+
+// rebuild the erased data shards in place from the surviving shards.
+// shards[] must hold all gfm_codec_shards() pointers, those that
+// were erased are overwritten (data) or ignored (parity).
+// Shards a partial decoder doesn't need may be NULL.
+int  gfm_decode(const gfm_decoder * decoder,
+                uint8_t * const * shards,
+                size_t len);
+
+// the framing used by the gfm tool to carry a byte stream.
+// The data shards of the stripe must abut: stripe[0 .. size-1],
+// size = numData * len. The last byte of the stripe is reserved to
+// record how much of the stripe is padding, so at most size-1 bytes
+// of payload fit.
+int    gfm_pad(uint8_t * stripe, size_t numRead, size_t size);
+// returns the number of payload bytes in a padded stripe,
+// GFM_EINVAL if the padding doesn't make sense (damaged, or not a
+// padded stripe)
+ssize_t gfm_unpad(uint8_t * stripe, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIBGFM_H
@@ -0,0 +1,114 @@
+#include "numa.hh"
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#ifdef GFM_NUMA
+#include <numa.h>
+#include <sched.h>
+#endif
+
+static thread_local int runningOn = NUMA_ANY;
+
+bool Numa::available()
+{
+#ifdef GFM_NUMA
+    static const bool avail = (numa_available() >= 0);
+    return avail;
+#else
+    return false;
+#endif
+}
+
+int Numa::nodes()
+{
+#ifdef GFM_NUMA
+    if (available())
+    {
+        return numa_max_node() + 1;
+    }
+#endif
+    return 1;
+}
+
+void Numa::runOn(int node)
+{
+    runningOn = node;
+#ifdef GFM_NUMA
+    if (available())
+    {
+        numa_run_on_node(node);
+    }
+#endif
+}
+
+int Numa::current()
+{
+    return runningOn;
+}
+
+int Numa::here()
+{
+#ifdef GFM_NUMA
+    if (available())
+    {
+        int cpu = sched_getcpu();
+        int node = (cpu < 0) ? 0 : numa_node_of_cpu(cpu);
+        return (node < 0) ? 0 : node;
+    }
+#endif
+    return 0;
+}
+
+void Numa::place(void * mem, size_t len, int node)
+{
+#ifdef GFM_NUMA
+    if (available() && (node >= 0))
+    {
+        numa_tonode_memory(mem, len, node);
+    }
+#else
+    (void)mem;
+    (void)len;
+    (void)node;
+#endif
+}
+
+int Numa::nodeOf(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st))
+    {
+        return NUMA_ANY;
+    }
+    dev_t dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+    // a disk's 'device' is the controller (or the namespace under
+    // it, for NVMe), a partition's is its disk's
+    static const char * const paths[] =
+    {
+        "device/numa_node",
+        "device/device/numa_node",
+        "../device/numa_node",
+        "../device/device/numa_node",
+    };
+    for (size_t p = 0; p < (sizeof(paths) / sizeof(paths[0])); p++)
+    {
+        char name[128];
+        snprintf(name, sizeof(name), "/sys/dev/block/%u:%u/%s",
+                 major(dev), minor(dev), paths[p]);
+        FILE * file = fopen(name, "r");
+        if (!file)
+        {
+            continue;
+        }
+        int node = NUMA_ANY;
+        if (fscanf(file, "%d", &node) != 1)
+        {
+            node = NUMA_ANY;
+        }
+        fclose(file);
+        return (node >= 0) ? node : NUMA_ANY;
+    }
+    return NUMA_ANY;
+}
@@ -0,0 +1,49 @@
+#ifndef NUMA_HH
+#define NUMA_HH
+
+#include <stddef.h>
+
+/*
+  NUMA placement, for --numa, --numa-io and --bench --numa: which node
+  a thread runs on, which node a stripe pool's memory comes from, and
+  which node the disk (its HBA) behind a file descriptor hangs off.
+
+  Built without GFM_NUMA (the Makefile defines it, with NUMA_LIBS,
+  when it finds libnuma-dev), or on a kernel without NUMA, there's
+  just the one node and placing things on it does nothing.
+*/
+
+/// no node in particular
+const int NUMA_ANY  = -1;
+/// work it out (--numa, --numa-io with no NODE)
+const int NUMA_AUTO = -2;
+
+class Numa
+{
+public:
+    // built with libnuma, and the kernel has NUMA
+    static bool available();
+
+    // how many there are, 1 if not available()
+    static int nodes();
+
+    // run the calling thread (and any it starts from now on) on the
+    // CPUs of 'node', anywhere for NUMA_ANY
+    static void runOn(int node);
+
+    // the node runOn() put the calling thread on, NUMA_ANY if it
+    // hasn't
+    static int current();
+
+    // the node the calling thread is on right now
+    static int here();
+
+    // 'len' bytes at 'mem' (not touched yet) come from 'node'
+    static void place(void * mem, size_t len, int node);
+
+    // the node the device under 'fd' is attached to, NUMA_ANY if
+    // it's not a block device or the kernel doesn't say
+    static int nodeOf(int fd);
+};
+
+#endif // NUMA_HH
@@ -0,0 +1,95 @@
+#include "pool.hh"
+
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// what MAP_HUGETLB gets, near enough everywhere
+static const size_t HUGE_PAGE = 2 << 20;
+
+StripePool::StripePool(size_t rows, size_t rowSize, size_t count,
+                       size_t limit, bool huge, int node)
+    : arena(0)
+    , arenaSize(0)
+    , stride(0)
+    , numStripes(0)
+    , backbone(0)
+{
+    // every stripe starts on a page boundary
+    const size_t page = sysconf(_SC_PAGESIZE);
+    stride = ((rows * rowSize) + page - 1) & ~(page - 1);
+
+    if (limit && ((count * stride) > limit))
+    {
+        count = limit / stride;
+    }
+    if (!count)
+    {
+        return;
+    }
+
+    void * mem = MAP_FAILED;
+    size_t size = count * stride;
+    if (huge)
+    {
+#ifdef MAP_HUGETLB
+        size_t hugeSize = (size + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+        mem = mmap(0, hugeSize, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mem != MAP_FAILED)
+        {
+            size = hugeSize;
+        }
+#endif
+    }
+    if (mem == MAP_FAILED)
+    {
+        mem = mmap(0, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+        {
+            return;
+        }
+#ifdef MADV_HUGEPAGE
+        // no reserved huge pages, let the kernel use some if it can
+        if (huge)
+        {
+            madvise(mem, size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+
+    // before anything touches it
+    Numa::place(mem, size, node);
+
+    backbone = (uint8_t **)calloc(count * rows, sizeof(uint8_t *));
+    if (!backbone)
+    {
+        munmap(mem, size);
+        return;
+    }
+    arena      = mem;
+    arenaSize  = size;
+    numStripes = count;
+
+    for (size_t s = 0; s < count; s++)
+    {
+        uint8_t ** stripe = backbone + (s * rows);
+        stripe[0] = (uint8_t *)arena + (s * stride);
+        // subsequent rows abut, as makeArray()
+        for (size_t r = 1; r < rows; r++)
+        {
+            stripe[r] = stripe[r - 1] + rowSize;
+        }
+        Put(stripe);
+    }
+}
+
+StripePool::~StripePool()
+{
+    if (arena)
+    {
+        munmap(arena, arenaSize);
+    }
+    free(backbone);
+}
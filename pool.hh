@@ -0,0 +1,132 @@
+#ifndef POOL_HH
+#define POOL_HH
+
+#include "numa.hh"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+
+// hands things from one stage of the stripe loops to the next,
+// in order. Pop() waits for something to turn up.
+template <typename T>
+class StageQueue
+{
+public:
+    void Push(const T & item)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                items.push_back(item);
+            }
+            cond.notify_one();
+        }
+
+    T Pop()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this]() { return !items.empty(); });
+            T item = items.front();
+            items.pop_front();
+            return item;
+        }
+
+private:
+    std::mutex              mutex;
+    std::condition_variable cond;
+    std::deque<T>           items;
+};
+
+// at most 'count' holders at a time
+class Semaphore
+{
+public:
+    explicit Semaphore(unsigned count)
+        : avail(count)
+        {
+        }
+
+    void Acquire()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this]() { return avail > 0; });
+            avail--;
+        }
+
+    void Release()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                avail++;
+            }
+            cond.notify_one();
+        }
+
+private:
+    std::mutex              mutex;
+    std::condition_variable cond;
+    unsigned                avail;
+};
+
+// A fixed number of stripe buffers carved out of one arena, so
+// nothing is allocated per stripe and the memory used is known up
+// front. Each stripe is laid out as by GFM::makeArray(), rows
+// abutting, and starts on a page (or huge page) boundary.
+// Get() and Put() may be called from any thread, the free list is
+// what the reader, compute and writer stages pass stripes back on.
+class StripePool
+{
+public:
+    // up to 'count' stripes of 'rows' x 'rowSize' bytes, fewer if
+    // they don't all fit in 'limit' bytes (0 for no limit).
+    // 'huge' asks for MAP_HUGETLB, failing that transparent huge
+    // pages. 'node' is the NUMA node the memory comes from, NUMA_ANY
+    // for wherever it's first touched.
+    // Check good(), it fails if not even one stripe fits.
+    StripePool(size_t rows, size_t rowSize, size_t count,
+               size_t limit = 0, bool huge = false, int node = NUMA_ANY);
+    ~StripePool();
+
+    bool good() const
+        {
+            return arena;
+        }
+
+    // how many stripes there are
+    size_t size() const
+        {
+            return numStripes;
+        }
+
+    // bytes per stripe, as counted against the limit
+    size_t stripeBytes() const
+        {
+            return stride;
+        }
+
+    // a free stripe, waits for one to be Put() back if need be
+    uint8_t ** Get()
+        {
+            return freeList.Pop();
+        }
+
+    void Put(uint8_t ** stripe)
+        {
+            freeList.Push(stripe);
+        }
+
+private:
+    StripePool(const StripePool &);
+    StripePool & operator=(const StripePool &);
+
+    void   * arena;
+    size_t   arenaSize;
+    size_t   stride;
+    size_t   numStripes;
+    uint8_t ** backbone;
+    StageQueue<uint8_t **> freeList;
+};
+
+#endif // POOL_HH
@@ -0,0 +1,30 @@
+#ifndef PROBES_HH
+#define PROBES_HH
+
+/*
+  USDT static tracepoints, provider "gfm", for perf and bpftrace:
+
+    $ bpftrace -e 'usdt:./gfm:gfm:shard_write_done { @[arg1] = count(); }'
+
+  With <sys/sdt.h> (systemtap-sdt-dev) each probe is a single nop
+  until a tracer attaches. Without it, or with -DGFM_NO_SDT, they
+  compile to nothing at all.
+*/
+
+#if defined(__has_include) && !defined(GFM_NO_SDT)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define GFM_SDT
+#endif
+#endif
+
+#ifdef GFM_SDT
+#define PROBE2(name, a, b)       DTRACE_PROBE2(gfm, name, a, b)
+#define PROBE3(name, a, b, c)    DTRACE_PROBE3(gfm, name, a, b, c)
+#else
+// sizeof() so the arguments count as used, but aren't evaluated
+#define PROBE2(name, a, b)       do { (void)sizeof(a); (void)sizeof(b); } while (0)
+#define PROBE3(name, a, b, c)    do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); } while (0)
+#endif
+
+#endif // PROBES_HH
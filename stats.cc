@@ -0,0 +1,173 @@
+#include "stats.hh"
+
+#include <stdio.h>
+
+Stats stats;
+
+static const char * stageName[Stats::NUM_STAGES] =
+{
+    "read",
+    "parity",
+    "decode",
+    "digest",
+    "write",
+    "zstd",
+};
+
+void Stats::Enable(bool wantSummary, const std::string & json, bool showProgress)
+{
+    enabled  = true;
+    summary  = wantSummary;
+    progress = showProgress;
+    jsonFile = json;
+    began    = now();
+    lastProgress = began;
+    stripes  = 0;
+    payload  = 0;
+    for (int idx = 0; idx < NUM_STAGES; idx++)
+    {
+        stages[idx].ns = 0;
+        stages[idx].bytes = 0;
+        stages[idx].calls = 0;
+        stages[idx].shortCalls = 0;
+    }
+    for (unsigned idx = 0; idx < MAX_SHARDS; idx++)
+    {
+        shards[idx].reads = 0;
+        shards[idx].ns    = 0;
+        shards[idx].maxNs = 0;
+        shards[idx].late  = 0;
+    }
+}
+
+// "\r  123.4 MiB   56.7 MB/s  ETA 0:00:12", at most once a second
+void Stats::Progress(bool last)
+{
+    uint64_t t = now();
+    uint64_t prev = lastProgress;
+    if (!last && (((t - prev) < 1000000000ull) ||
+                  !lastProgress.compare_exchange_strong(prev, t)))
+    {
+        return;
+    }
+    lastProgress = t;
+
+    double elapsed = (t - began) / 1e9;
+    double done = payload;
+    double rate = elapsed ? done / elapsed : 0;
+    fprintf(stderr, "\r%10.1f MiB %8.1f MB/s", done / (1 << 20), rate / 1e6);
+    if (expected && rate)
+    {
+        unsigned eta = (done < expected) ? (expected - done) / rate : 0;
+        fprintf(stderr, "  %5.1f%%  ETA %u:%02u:%02u",
+                100.0 * done / expected,
+                eta / 3600, (eta / 60) % 60, eta % 60);
+    }
+    fprintf(stderr, last ? "\n" : "   ");
+}
+
+void Stats::Report()
+{
+    if (!enabled)
+    {
+        return;
+    }
+    if (progress)
+    {
+        Progress(true);
+    }
+    if (!summary)
+    {
+        return;
+    }
+    uint64_t elapsed = now() - began;
+
+    if (jsonFile.empty())
+    {
+        fprintf(stderr,
+                "gfm: %llu stripes, %llu bytes in %.3f s\n"
+                "  %-8s %10s %12s %10s %10s %10s\n",
+                (unsigned long long)stripes,
+                (unsigned long long)payload,
+                elapsed / 1e9,
+                "stage", "seconds", "bytes", "MB/s", "syscalls", "short");
+        for (int idx = 0; idx < NUM_STAGES; idx++)
+        {
+            const Counter & c = stages[idx];
+            if (!c.ns && !c.calls) continue;
+            fprintf(stderr, "  %-8s %10.3f %12llu %10.1f %10llu %10llu\n",
+                    stageName[idx],
+                    c.ns / 1e9,
+                    (unsigned long long)c.bytes,
+                    c.ns ? (c.bytes * 1e3) / c.ns : 0.0,
+                    (unsigned long long)c.calls,
+                    (unsigned long long)c.shortCalls);
+        }
+        bool heading = true;
+        for (unsigned idx = 0; idx < MAX_SHARDS; idx++)
+        {
+            const ShardCounter & c = shards[idx];
+            if (!c.reads) continue;
+            if (heading)
+            {
+                fprintf(stderr, "  %-8s %10s %10s %10s %10s\n",
+                        "shard", "reads", "avg ms", "max ms", "late");
+                heading = false;
+            }
+            fprintf(stderr, "  %02x       %10llu %10.3f %10.3f %10llu\n",
+                    idx,
+                    (unsigned long long)c.reads,
+                    c.ns / (c.reads * 1e6),
+                    c.maxNs / 1e6,
+                    (unsigned long long)c.late);
+        }
+        return;
+    }
+
+    FILE * file = fopen(jsonFile.c_str(), "w");
+    if (!file)
+    {
+        fprintf(stderr, "Unable to write stats to '%s': %m\n",
+                jsonFile.c_str());
+        return;
+    }
+    fprintf(file,
+            "{\n  \"stripes\": %llu,\n  \"bytes\": %llu,\n"
+            "  \"elapsedNs\": %llu,\n  \"stages\": {",
+            (unsigned long long)stripes,
+            (unsigned long long)payload,
+            (unsigned long long)elapsed);
+    const char * sep = "";
+    for (int idx = 0; idx < NUM_STAGES; idx++)
+    {
+        const Counter & c = stages[idx];
+        if (!c.ns && !c.calls) continue;
+        fprintf(file,
+                "%s\n    \"%s\": {\"ns\": %llu, \"bytes\": %llu,"
+                " \"syscalls\": %llu, \"short\": %llu}",
+                sep, stageName[idx],
+                (unsigned long long)c.ns,
+                (unsigned long long)c.bytes,
+                (unsigned long long)c.calls,
+                (unsigned long long)c.shortCalls);
+        sep = ",";
+    }
+    fprintf(file, "\n  },\n  \"shards\": {");
+    sep = "";
+    for (unsigned idx = 0; idx < MAX_SHARDS; idx++)
+    {
+        const ShardCounter & c = shards[idx];
+        if (!c.reads) continue;
+        fprintf(file,
+                "%s\n    \"%02x\": {\"reads\": %llu, \"ns\": %llu,"
+                " \"maxNs\": %llu, \"late\": %llu}",
+                sep, idx,
+                (unsigned long long)c.reads,
+                (unsigned long long)c.ns,
+                (unsigned long long)c.maxNs,
+                (unsigned long long)c.late);
+        sep = ",";
+    }
+    fprintf(file, "\n  }\n}\n");
+    fclose(file);
+}
@@ -0,0 +1,145 @@
+#ifndef STATS_HH
+#define STATS_HH
+
+#include "timer.hh"
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+// Per-stage counters for --stats / GFM_STATS.
+// When disabled every call is a single test of 'enabled',
+// so they can stay in the stripe loops.
+class Stats
+{
+public:
+    // as many as there can be
+    static const unsigned MAX_SHARDS = 256;
+
+    enum Stage
+    {
+        READ,
+        PARITY,
+        DECODE,
+        DIGEST,
+        WRITE,
+        ZSTD,
+        NUM_STAGES
+    };
+
+    Stats()
+        : enabled(false)
+        , summary(false)
+        , progress(false)
+        , expected(0)
+        , began(0)
+        , lastProgress(0)
+        , stripes(0)
+        , payload(0)
+        {
+        }
+
+    // start timing something
+    inline uint64_t start() const
+        {
+            return enabled ? now() : 0;
+        }
+
+    // ... and account for it
+    inline void stop(Stage stage, uint64_t t0, uint64_t bytes)
+        {
+            if (!enabled) return;
+            stages[stage].ns    += now() - t0;
+            stages[stage].bytes += bytes;
+        }
+
+    // a read() or write() done for the stage, 'isShort' if it
+    // transferred less than was asked for
+    inline void syscall(Stage stage, bool isShort = false)
+        {
+            if (!enabled) return;
+            stages[stage].calls++;
+            if (isShort) stages[stage].shortCalls++;
+        }
+
+    // a block read from shard 'idx', started at 't0'
+    inline void shard(unsigned idx, uint64_t t0)
+        {
+            if (!enabled) return;
+            uint64_t ns = now() - t0;
+            ShardCounter & c = shards[idx];
+            c.reads++;
+            c.ns += ns;
+            uint64_t max = c.maxNs;
+            while ((ns > max) && !c.maxNs.compare_exchange_weak(max, ns))
+            {
+            }
+        }
+
+    // ... that arrived after the stripe had been decoded without it
+    inline void late(unsigned idx)
+        {
+            if (!enabled) return;
+            shards[idx].late++;
+        }
+
+    // another stripe done, 'bytes' of the stream (in or out) with it
+    inline void stripe(uint64_t bytes)
+        {
+            if (!enabled) return;
+            stripes++;
+            payload += bytes;
+            if (progress) Progress(false);
+        }
+
+    // turn it all on. At the end the counters go to 'json' or, if
+    // that's "", a summary to stderr (unless !summary).
+    void Enable(bool summary, const std::string & json, bool showProgress);
+    // size of the stream if known, for the ETA
+    void Expect(uint64_t total)
+        {
+            expected = total;
+        }
+
+    // print the summary (and finish off the progress line)
+    void Report();
+
+    bool enabled;
+
+private:
+    void Progress(bool last);
+
+    struct Counter
+    {
+        std::atomic<uint64_t> ns;
+        std::atomic<uint64_t> bytes;
+        std::atomic<uint64_t> calls;
+        std::atomic<uint64_t> shortCalls;
+    };
+
+    struct ShardCounter
+    {
+        std::atomic<uint64_t> reads;
+        std::atomic<uint64_t> ns;
+        std::atomic<uint64_t> maxNs;
+        std::atomic<uint64_t> late;
+    };
+
+    bool        summary;
+    bool        progress;
+    std::string jsonFile;
+    uint64_t    expected;
+    uint64_t    began;
+    // --jobs stripes it from several threads, only one gets to print
+    std::atomic<uint64_t> lastProgress;
+    std::atomic<uint64_t> stripes;
+    std::atomic<uint64_t> payload;
+    Counter     stages[NUM_STAGES];
+    // per shard read latency
+    ShardCounter shards[MAX_SHARDS];
+};
+
+// the one and only
+extern Stats stats;
+
+#endif // STATS_HH
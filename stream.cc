@@ -0,0 +1,850 @@
+#include "libgfm.h"
+#include "pool.hh"
+#include "stats.hh"
+#include "throttle.hh"
+#include "wire.hh"
+#include "zstage.hh"
+
+#include <algorithm>
+#include <array>
+#include <fcntl.h>
+#include <limits.h>
+#include <map>
+#include <openssl/evp.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+void attest(bool test, const char * epilogue, ...);
+ssize_t readFully(int fd, void * buff, ssize_t len, bool isPipe = false);
+void IoNear(int fd);
+gfm_codec * MakeCodec(const uint8_t numData, const uint8_t numParity,
+                      const uint8_t numGroups);
+
+extern size_t   memLimit;
+extern bool     hugePages;
+extern bool     useZstd;
+extern int      zstdLevel;
+extern unsigned zstdThreads;
+
+/*
+  --stream: all the shards in one stream, for tape, a pipe or a single
+  object, rather than a file each. Every block is a record:
+
+    streamRecord (RECORD_LEN bytes), then 'length' bytes of it
+
+  The stripes go in groups of DEPTH, and the records of a group in
+  shard order: shard 0 of each of its stripes, then shard 1 of each
+  and so on. Losing a run of DEPTH records costs each stripe at most
+  one or two blocks, so as long as NUM_PARITY - 1 times that, about
+  NUM_PARITY - 1 x DEPTH x 4K, recovery carries on as if a few shards
+  were missing.
+
+  Each group starts with a STREAM_HEADER record, so if the first one
+  is lost recovery finds the geometry in the next (the records before
+  it are kept), and the stream ends with a STREAM_END one. Recovery
+  still needs the stripes from the first on, it can't start on a
+  stream part way through.
+  A CRC-32C covers every record, a bad one is skipped (and the next
+  found by its magic) and its block counted as missing. A block of
+  zeros is a record with RECORD_ZERO and no block.
+
+  In the stream each field is at a fixed offset, in the order below,
+  little-endian (see packRecord() and friends), so a stream written
+  on one machine reads on any other.
+*/
+struct streamRecord
+{
+    char     magic[4];
+    // 0 .. NUM_SHARDS - 1, or STREAM_HEADER / STREAM_END
+    uint8_t  shard;
+    uint8_t  flags;
+    uint16_t reserved;
+    // of what follows
+    uint32_t length;
+    // of this, crc 0, and what follows
+    uint32_t crc;
+    uint64_t stripe;
+};
+
+// the STREAM_HEADER payload
+struct streamHeader
+{
+    uint8_t  version;
+    uint8_t  numData;
+    uint8_t  numParity;
+    uint8_t  numGroups;
+    uint8_t  blocksizePo2;
+    // SHARD_PLAIN or SHARD_ZSTD
+    uint8_t  compression;
+    uint16_t depth;
+};
+
+// the STREAM_END payload
+struct streamEnd
+{
+    uint64_t numStripes;
+    // of the stream that went in
+    uint8_t  md5[16];
+};
+
+static const char    RECORD_MAGIC[4] = {'G', 'F', 'M', 'R'};
+// bytes of each in the stream
+static const size_t  RECORD_LEN      = 24;
+static const size_t  HEADER_LEN      = 8;
+static const size_t  END_LEN         = 24;
+static const uint8_t STREAM_VERSION  = 1;
+static const uint8_t STREAM_HEADER   = 0xfe;
+static const uint8_t STREAM_END      = 0xff;
+static const uint8_t RECORD_ZERO     = 1;
+// records at a time to writev()
+static const size_t  STREAM_IOV      = 512;
+// records kept while looking for the first header
+static const size_t  STREAM_BEFORE   = 8192;
+// stripes in flight besides those of the group being put together
+static const size_t  STREAM_PIPELINE = 8;
+
+// CRC-32C (Castagnoli), with SSE 4.2's crc32 where there is one
+static uint32_t crcTable[256];
+
+static void crcInit()
+{
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++)
+        {
+            c = (c & 1) ? (0x82f63b78 ^ (c >> 1)) : (c >> 1);
+        }
+        crcTable[n] = c;
+    }
+}
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+
+__attribute__((target("sse4.2")))
+static uint32_t crcSse42(uint32_t crc, const uint8_t * data, size_t len)
+{
+    uint64_t c = crc;
+    for (; len >= 8; data += 8, len -= 8)
+    {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        c = _mm_crc32_u64(c, word);
+    }
+    crc = c;
+    for (; len; data++, len--)
+    {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+    return crc;
+}
+#endif
+
+static uint32_t crc32c(uint32_t crc, const void * buff, size_t len)
+{
+    const uint8_t * data = (const uint8_t *)buff;
+    crc = ~crc;
+#if defined(__x86_64__)
+    static const bool sse42 = __builtin_cpu_supports("sse4.2");
+    if (sse42)
+    {
+        return ~crcSse42(crc, data, len);
+    }
+#endif
+    static bool once = (crcInit(), true);
+    (void)once;
+    for (; len; data++, len--)
+    {
+        crc = crcTable[(crc ^ *data) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void packRecord(const streamRecord & rec, uint8_t * out)
+{
+    memcpy(out, rec.magic, sizeof(rec.magic));
+    out[4] = rec.shard;
+    out[5] = rec.flags;
+    putLE16(out + 6, rec.reserved);
+    putLE32(out + 8, rec.length);
+    putLE32(out + 12, rec.crc);
+    putLE64(out + 16, rec.stripe);
+}
+
+static void unpackRecord(const uint8_t * in, streamRecord & rec)
+{
+    memcpy(rec.magic, in, sizeof(rec.magic));
+    rec.shard    = in[4];
+    rec.flags    = in[5];
+    rec.reserved = getLE16(in + 6);
+    rec.length   = getLE32(in + 8);
+    rec.crc      = getLE32(in + 12);
+    rec.stripe   = getLE64(in + 16);
+}
+
+static void packHeader(const streamHeader & hdr, uint8_t * out)
+{
+    out[0] = hdr.version;
+    out[1] = hdr.numData;
+    out[2] = hdr.numParity;
+    out[3] = hdr.numGroups;
+    out[4] = hdr.blocksizePo2;
+    out[5] = hdr.compression;
+    putLE16(out + 6, hdr.depth);
+}
+
+static void unpackHeader(const uint8_t * in, streamHeader & hdr)
+{
+    hdr.version      = in[0];
+    hdr.numData      = in[1];
+    hdr.numParity    = in[2];
+    hdr.numGroups    = in[3];
+    hdr.blocksizePo2 = in[4];
+    hdr.compression  = in[5];
+    hdr.depth        = getLE16(in + 6);
+}
+
+static void packEnd(const streamEnd & end, uint8_t * out)
+{
+    putLE64(out, end.numStripes);
+    memcpy(out + 8, end.md5, sizeof(end.md5));
+}
+
+static void unpackEnd(const uint8_t * in, streamEnd & end)
+{
+    end.numStripes = getLE64(in);
+    memcpy(end.md5, in + 8, sizeof(end.md5));
+}
+
+// the RECORD_LEN bytes at 'out' for a record of 'length' bytes of
+// 'payload', the CRC over both
+static void makeRecord(uint8_t * out, uint8_t shard, uint64_t stripe,
+                       uint8_t flags, const void * payload, uint32_t length)
+{
+    streamRecord rec;
+    memcpy(rec.magic, RECORD_MAGIC, sizeof(rec.magic));
+    rec.shard    = shard;
+    rec.flags    = flags;
+    rec.reserved = 0;
+    rec.length   = length;
+    rec.crc      = 0;
+    rec.stripe   = stripe;
+    packRecord(rec, out);
+    putLE32(out + 12, crc32c(crc32c(0, out, RECORD_LEN), payload, length));
+}
+
+// a stripe on its way through, in stripe order
+struct StreamStripe
+{
+    // 0 marks the end
+    uint8_t ** buff;
+    uint64_t   index;
+    ssize_t    numRead;
+    // recovery: the shards there were no (good) record for
+    std::vector<uint8_t> erased;
+    // nothing but zeros
+    bool       zero;
+};
+
+// where the stream goes (or comes from), "-" for stdout (stdin)
+static int openStream(const std::string & stub, bool write)
+{
+    if (stub == "-")
+    {
+        return write ? STDOUT_FILENO : STDIN_FILENO;
+    }
+    int fd = write
+        ? open(stub.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)
+        : open(stub.c_str(), O_RDONLY);
+    attest(fd >= 0, "Unable to open '%s': %m", stub.c_str());
+    return fd;
+}
+
+// gathers records (and the blocks they point to) for writev()
+class RecordWriter
+{
+public:
+    RecordWriter(int fd_)
+        : fd(fd_)
+        , records(STREAM_IOV)
+        , numRecords(0)
+        {
+        }
+
+    // 'payload' has to stay put until Flush()
+    void Add(uint8_t shard, uint64_t stripe, uint8_t flags,
+             const void * payload, uint32_t length)
+        {
+            uint8_t * rec = records[numRecords++].data();
+            makeRecord(rec, shard, stripe, flags, payload, length);
+            iov.push_back({rec, RECORD_LEN});
+            if (length)
+            {
+                iov.push_back({(void *)payload, length});
+            }
+            if (numRecords == records.size())
+            {
+                Flush();
+            }
+        }
+
+    void Flush()
+        {
+            for (size_t done = 0; done < iov.size(); )
+            {
+                size_t count = std::min<size_t>(iov.size() - done, IOV_MAX);
+                uint64_t t = stats.start();
+                const uint64_t w = throttle.start();
+                ssize_t n = writev(fd, &iov[done], count);
+                attest(n > 0, "Unable to write stream: %m");
+                throttle.Write(n, w);
+                stats.syscall(Stats::WRITE);
+                stats.stop(Stats::WRITE, t, n);
+                // a tape or socket may take less, the rest goes again
+                for (; n && ((size_t)n >= iov[done].iov_len); done++)
+                {
+                    n -= iov[done].iov_len;
+                }
+                if (n)
+                {
+                    iov[done].iov_base = (uint8_t *)iov[done].iov_base + n;
+                    iov[done].iov_len -= n;
+                }
+            }
+            iov.clear();
+            numRecords = 0;
+        }
+
+private:
+    int fd;
+    std::vector<std::array<uint8_t, RECORD_LEN> > records;
+    size_t numRecords;
+    std::vector<struct iovec> iov;
+};
+
+/**
+   gfm --stream STUB NUM_DATA NUM_PARITY: as CreateParity(), but all
+   of it in one stream to STUB ("-" for stdout), 'depth' stripes to a
+   group.
+*/
+int StreamEncode(const gfm_codec * codec, int in, const std::string & stub,
+                 size_t blockSize, uint8_t blocksizePo2, unsigned depth)
+{
+    const uint8_t numData = gfm_codec_data(codec);
+    const int     rows    = gfm_codec_shards(codec);
+    const int     out     = openStream(stub, true);
+
+    StripePool * pool = new StripePool(rows, blockSize, depth + STREAM_PIPELINE,
+                                       memLimit, hugePages, Numa::current());
+    attest(pool->good() && (pool->size() > depth),
+           "Unable to allocate %u + %zu stripes of %d x %zu%s",
+           depth, STREAM_PIPELINE, rows, blockSize,
+           memLimit ? " within --mem-limit" : "");
+
+    streamHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.version      = STREAM_VERSION;
+    hdr.numData      = numData;
+    hdr.numParity    = gfm_codec_parity(codec);
+    hdr.numGroups    = gfm_codec_groups(codec);
+    hdr.blocksizePo2 = blocksizePo2;
+    hdr.compression  = useZstd ? SHARD_ZSTD : SHARD_PLAIN;
+    hdr.depth        = depth;
+    // every group's STREAM_HEADER record
+    uint8_t hdrBytes[HEADER_LEN];
+    packHeader(hdr, hdrBytes);
+
+    EVP_MD_CTX * md5 = EVP_MD_CTX_new();
+    attest(md5, "Unable to create MD context");
+    EVP_DigestInit_ex(md5, EVP_md5(), 0);
+
+    // --zstd: compress it on the way in, the digest is of what came in
+    ZStage * zstd = 0;
+    if (useZstd)
+    {
+        int p[2];
+        attest(!pipe(p), "Unable to create pipe: %m");
+        zstd = new ZStage(true, in, p[1], zstdLevel, zstdThreads, md5);
+        in = p[0];
+    }
+
+    StageQueue<StreamStripe> toCompute;
+    StageQueue<StreamStripe> toWrite;
+
+    std::thread reader([&]()
+    {
+        IoNear(in);
+        for (uint64_t stripe = 0; ; stripe++)
+        {
+            uint8_t ** buff = pool->Get();
+            uint64_t t = stats.start();
+            memset(buff[0], 0, numData * blockSize);
+            ssize_t numRead = readFully(in, buff[0], (numData * blockSize) - 1,
+                                        zstd);
+            attest(numRead >= 0, "Unable to read input: %m");
+            stats.stop(Stats::READ, t, numRead);
+            if (!zstd)
+            {
+                throttle.Read(numRead);
+            }
+
+            StreamStripe s = {buff, stripe, numRead, {}, false};
+            toCompute.Push(s);
+            if (numRead != (ssize_t)((numData * blockSize) - 1))
+            {
+                break;
+            }
+        }
+        toCompute.Push(StreamStripe{0, 0, 0, {}, false});
+    });
+
+    // a group at a time, shard by shard
+    uint64_t numStripes = 0;
+    std::thread writer([&]()
+    {
+        IoNear(out);
+        RecordWriter records(out);
+        std::vector<StreamStripe> group;
+        bool more = true;
+        while (more)
+        {
+            StreamStripe s = toWrite.Pop();
+            more = s.buff;
+            if (more)
+            {
+                group.push_back(s);
+                numStripes++;
+                if (group.size() < depth)
+                {
+                    continue;
+                }
+            }
+            if (group.empty())
+            {
+                break;
+            }
+            records.Add(STREAM_HEADER, group[0].index, 0, hdrBytes, HEADER_LEN);
+            for (int row = 0; row < rows; row++)
+            {
+                for (size_t g = 0; g < group.size(); g++)
+                {
+                    const uint8_t * block = group[g].buff[row];
+                    const bool zero = group[g].zero ||
+                        gfm_is_zero(codec, block, blockSize);
+                    records.Add(row, group[g].index, zero ? RECORD_ZERO : 0,
+                                block, zero ? 0 : blockSize);
+                }
+            }
+            // the blocks have to be out before the buffers go back
+            records.Flush();
+            for (size_t g = 0; g < group.size(); g++)
+            {
+                stats.stripe(group[g].numRead);
+                pool->Put(group[g].buff);
+            }
+            group.clear();
+        }
+
+        // the digest is done once the input's all been read
+        if (zstd)
+        {
+            zstd->Join();
+        }
+        streamEnd end;
+        memset(&end, 0, sizeof(end));
+        end.numStripes = numStripes;
+        unsigned int len = sizeof(end.md5);
+        EVP_DigestFinal_ex(md5, end.md5, &len);
+        uint8_t endBytes[END_LEN];
+        packEnd(end, endBytes);
+        records.Add(STREAM_END, numStripes, 0, endBytes, END_LEN);
+        records.Flush();
+    });
+
+    for (StreamStripe s = toCompute.Pop(); s.buff; s = toCompute.Pop())
+    {
+        uint64_t t = stats.start();
+        gfm_pad(s.buff[0], s.numRead, numData * blockSize);
+        s.zero = gfm_is_zero(codec, s.buff[0], numData * blockSize);
+        if (!s.zero)
+        {
+            gfm_encode(codec, s.buff, blockSize);
+        }
+        stats.stop(Stats::PARITY, t, numData * blockSize);
+
+        if (!zstd)
+        {
+            t = stats.start();
+            EVP_DigestUpdate(md5, s.buff[0], s.numRead);
+            stats.stop(Stats::DIGEST, t, s.numRead);
+        }
+        toWrite.Push(s);
+    }
+    toWrite.Push(StreamStripe{0, 0, 0, {}, false});
+    reader.join();
+    writer.join();
+
+    delete zstd;
+    EVP_MD_CTX_free(md5);
+    attest(!close(out), "Unable to write '%s': %m", stub.c_str());
+    delete pool;
+    return 0;
+}
+
+// the good records in a stream, in order, skipping over the bad
+class RecordReader
+{
+public:
+    RecordReader(int fd_, size_t maxPayload_)
+        : fd(fd_)
+        , maxPayload(maxPayload_)
+        , buff(std::max<size_t>(1 << 20, 4 * (RECORD_LEN + maxPayload)))
+        , pos(0)
+        , end(0)
+        , eof(false)
+        , skipped(0)
+        {
+        }
+
+    // the next one, false at the end. 'payload' is good until the
+    // next call.
+    bool Next(streamRecord & rec, const uint8_t *& payload)
+        {
+            for (;;)
+            {
+                if (!Fill(RECORD_LEN))
+                {
+                    skipped += end - pos;
+                    pos = end;
+                    return false;
+                }
+                unpackRecord(&buff[pos], rec);
+                if (!memcmp(rec.magic, RECORD_MAGIC, sizeof(rec.magic)) &&
+                    (rec.length <= maxPayload) &&
+                    Fill(RECORD_LEN + rec.length))
+                {
+                    // Fill() may have moved it
+                    uint8_t chk[RECORD_LEN];
+                    memcpy(chk, &buff[pos], RECORD_LEN);
+                    putLE32(chk + 12, 0);
+                    const uint8_t * p = &buff[pos + RECORD_LEN];
+                    if (crc32c(crc32c(0, chk, RECORD_LEN), p, rec.length) == rec.crc)
+                    {
+                        payload = p;
+                        pos += RECORD_LEN + rec.length;
+                        return true;
+                    }
+                }
+                // not a record, or a damaged one: on to the next magic
+                const uint8_t * next = (const uint8_t *)
+                    memmem(&buff[pos + 1], end - pos - 1,
+                           RECORD_MAGIC, sizeof(RECORD_MAGIC));
+                size_t to = next
+                    ? (next - &buff[0])
+                    : std::max(pos + 1, end - (sizeof(RECORD_MAGIC) - 1));
+                skipped += to - pos;
+                pos = to;
+            }
+        }
+
+    // bytes that weren't part of a good record
+    uint64_t skippedBytes() const
+        {
+            return skipped;
+        }
+
+private:
+    // at least 'len' bytes from pos, false if the stream ends first
+    bool Fill(size_t len)
+        {
+            if ((end - pos) >= len)
+            {
+                return true;
+            }
+            memmove(&buff[0], &buff[pos], end - pos);
+            end -= pos;
+            pos = 0;
+            while (!eof && ((end - pos) < len))
+            {
+                uint64_t t = stats.start();
+                ssize_t n = read(fd, &buff[end], buff.size() - end);
+                attest(n >= 0, "Unable to read stream: %m");
+                stats.syscall(Stats::READ, false);
+                stats.stop(Stats::READ, t, n);
+                throttle.Read(n);
+                eof = !n;
+                end += n;
+            }
+            return (end - pos) >= len;
+        }
+
+    int    fd;
+    size_t maxPayload;
+    std::vector<uint8_t> buff;
+    size_t pos;
+    size_t end;
+    bool   eof;
+    uint64_t skipped;
+};
+
+/**
+   gfm --stream STUB: recover what StreamEncode() wrote to STUB ("-"
+   for stdin), on to 'out'. The records are sorted back into stripes
+   as they're read, a group's worth at a time, and each stripe is
+   decoded from whichever of its blocks turned up. Returns the exit
+   status: not 0 if the output doesn't match the digest at the end, or
+   there's no end.
+*/
+int StreamDecode(const std::string & stub, int out,
+                 size_t blockSize, uint8_t blocksizePo2)
+{
+    const int in = openStream(stub, false);
+    RecordReader reader(in, std::max(blockSize, HEADER_LEN + END_LEN));
+
+    // everything's from the first header, the records before it (if
+    // it's not the first) are kept for once it's been found
+    streamRecord rec;
+    const uint8_t * payload = 0;
+    std::vector<std::pair<streamRecord, std::vector<uint8_t> > > before;
+    bool found = false;
+    while (!found && (before.size() < STREAM_BEFORE) && reader.Next(rec, payload))
+    {
+        found = (rec.shard == STREAM_HEADER) && (rec.length == HEADER_LEN);
+        if (!found)
+        {
+            before.push_back(std::make_pair(rec, std::vector<uint8_t>(payload, payload + rec.length)));
+        }
+    }
+    attest(found, "No gfm stream in '%s'", stub.c_str());
+    streamHeader hdr;
+    unpackHeader(payload, hdr);
+    attest((hdr.version == STREAM_VERSION) &&
+           (hdr.blocksizePo2 == blocksizePo2) &&
+           hdr.numData && hdr.numParity && hdr.depth &&
+           (hdr.numGroups <= hdr.numData) &&
+           ((hdr.numData + hdr.numParity + hdr.numGroups) <= 250) &&
+           (hdr.compression <= SHARD_ZSTD),
+           "Bad gfm stream header in '%s'", stub.c_str());
+
+    gfm_codec * codec = MakeCodec(hdr.numData, hdr.numParity, hdr.numGroups);
+    const uint8_t  numData = hdr.numData;
+    const int      rows    = gfm_codec_shards(codec);
+    const uint64_t depth   = hdr.depth;
+
+    StripePool * pool = new StripePool(rows, blockSize, depth + STREAM_PIPELINE,
+                                       memLimit, hugePages, Numa::current());
+    attest(pool->good() && (pool->size() > depth),
+           "Unable to allocate %llu + %zu stripes of %d x %zu%s",
+           (unsigned long long)depth, STREAM_PIPELINE, rows, blockSize,
+           memLimit ? " within --mem-limit" : "");
+
+    // decompress on the way out if it was compressed on the way in
+    EVP_MD_CTX * md5 = EVP_MD_CTX_new();
+    attest(md5, "Unable to create MD context");
+    EVP_DigestInit_ex(md5, EVP_md5(), 0);
+    bool unzstd = (hdr.compression == SHARD_ZSTD);
+    bool checkMd5 = true;
+    if (unzstd && !ZStage::available())
+    {
+        fprintf(stderr, "gfm was built without zstd, this is the compressed"
+                " stream, try '| zstd -d'\n");
+        unzstd   = false;
+        checkMd5 = false;
+    }
+    ZStage * zstd = 0;
+    if (unzstd)
+    {
+        int p[2];
+        attest(!pipe(p), "Unable to create pipe: %m");
+        zstd = new ZStage(false, p[0], dup(out), 0, zstdThreads, md5);
+        out = p[1];
+    }
+
+    StageQueue<StreamStripe> toCompute;
+    StageQueue<StreamStripe> toWrite;
+    streamEnd end;
+    bool haveEnd = false;
+
+    // sort the records into stripes, a group is done once there's a
+    // record from a later one
+    std::thread demux([&]()
+    {
+        IoNear(in);
+        std::map<uint64_t, StreamStripe> open;
+        uint64_t next = 0;
+        // pass on everything before 'before', in order
+        auto flush = [&](uint64_t before)
+        {
+            while (!open.empty() && (open.begin()->first < before))
+            {
+                StreamStripe & s = open.begin()->second;
+                attest(s.index == next, "Stripe %llu lost, unable to recover",
+                       (unsigned long long)next);
+                toCompute.Push(s);
+                open.erase(open.begin());
+                next++;
+            }
+        };
+        auto demux = [&](const streamRecord & rec, const uint8_t * payload)
+        {
+            if (rec.shard == STREAM_END)
+            {
+                if (rec.length == END_LEN)
+                {
+                    unpackEnd(payload, end);
+                    haveEnd = true;
+                }
+                return;
+            }
+            if ((rec.shard >= rows) || (rec.stripe < next) ||
+                ((rec.length != blockSize) && (rec.length || !(rec.flags & RECORD_ZERO))))
+            {
+                // a header, a stripe that's been and gone, or nonsense
+                return;
+            }
+            flush(rec.stripe - (rec.stripe % depth));
+
+            auto found = open.find(rec.stripe);
+            if (found == open.end())
+            {
+                StreamStripe s = {pool->Get(), rec.stripe, 0,
+                                  std::vector<uint8_t>(rows, 1), true};
+                found = open.insert(std::make_pair(rec.stripe, s)).first;
+            }
+            StreamStripe & s = found->second;
+            if (!s.erased[rec.shard])
+            {
+                return;
+            }
+            s.erased[rec.shard] = 0;
+            if (rec.flags & RECORD_ZERO)
+            {
+                memset(s.buff[rec.shard], 0, blockSize);
+                return;
+            }
+            memcpy(s.buff[rec.shard], payload, blockSize);
+            s.numRead += blockSize;
+            s.zero = false;
+        };
+        for (size_t b = 0; b < before.size(); b++)
+        {
+            demux(before[b].first, before[b].second.data());
+        }
+        before.clear();
+        while (reader.Next(rec, payload))
+        {
+            demux(rec, payload);
+        }
+
+        // and the rest, all of them
+        flush(haveEnd ? end.numStripes : UINT64_MAX);
+        attest(!haveEnd || (next == end.numStripes),
+               "Stripes %llu on lost, unable to recover",
+               (unsigned long long)next);
+        toCompute.Push(StreamStripe{0, 0, 0, {}, false});
+    });
+
+    std::thread writer([&]()
+    {
+        IoNear(out);
+        for (StreamStripe s = toWrite.Pop(); s.buff; s = toWrite.Pop())
+        {
+            uint64_t t = stats.start();
+            const uint64_t w = throttle.start();
+            ssize_t numWritten = write(out, s.buff[0], s.numRead);
+            attest(numWritten == s.numRead, "Expected to write %zd, wrote %zd",
+                   s.numRead, numWritten);
+            throttle.Write(numWritten, w);
+            stats.syscall(Stats::WRITE);
+            stats.stop(Stats::WRITE, t, numWritten);
+            stats.stripe(numWritten);
+            if (!zstd)
+            {
+                t = stats.start();
+                EVP_DigestUpdate(md5, s.buff[0], numWritten);
+                stats.stop(Stats::DIGEST, t, numWritten);
+            }
+            pool->Put(s.buff);
+        }
+    });
+
+    // one per erasure pattern, i.e. not many
+    std::map<std::vector<uint8_t>, gfm_decoder *> decoders;
+    for (StreamStripe s = toCompute.Pop(); s.buff; s = toCompute.Pop())
+    {
+        gfm_decoder *& rcvr = decoders[s.erased];
+        if (!rcvr)
+        {
+            int rc = gfm_decoder_create(codec, s.erased.data(), &rcvr);
+            attest(rc == GFM_OK, "Unable to recover stripe %llu: %s",
+                   (unsigned long long)s.index, gfm_strerror(rc));
+        }
+        uint64_t t = stats.start();
+        // all zeros, whatever's missing is too
+        if (!s.zero)
+        {
+            gfm_decode(rcvr, s.buff, blockSize);
+        }
+        else
+        {
+            memset(s.buff[0], 0, numData * blockSize);
+        }
+        stats.stop(Stats::DECODE, t, numData * blockSize);
+
+        s.numRead = gfm_unpad(s.buff[0], numData * blockSize);
+        attest(s.numRead >= 0, "Stripe %llu is damaged, unable to recover",
+               (unsigned long long)s.index);
+        toWrite.Push(s);
+    }
+    toWrite.Push(StreamStripe{0, 0, 0, {}, false});
+    demux.join();
+    writer.join();
+    if (zstd)
+    {
+        close(out);
+        zstd->Join();
+        delete zstd;
+    }
+    if (in != STDIN_FILENO)
+    {
+        close(in);
+    }
+
+    int status = 0;
+    if (reader.skippedBytes())
+    {
+        fprintf(stderr, "Skipped %llu bytes of damaged stream\n",
+                (unsigned long long)reader.skippedBytes());
+    }
+    if (!haveEnd)
+    {
+        fprintf(stderr, "No end to the stream, it may have been cut short\n");
+        status = 1;
+    }
+    else if (checkMd5)
+    {
+        uint8_t md[EVP_MAX_MD_SIZE];
+        unsigned int len = sizeof(md);
+        EVP_DigestFinal_ex(md5, md, &len);
+        if (memcmp(md, end.md5, sizeof(end.md5)))
+        {
+            fprintf(stderr, "Output doesn't match the stream's MD5\n");
+            status = 1;
+        }
+    }
+
+    EVP_MD_CTX_free(md5);
+    for (auto & d : decoders)
+    {
+        gfm_decoder_destroy(d.second);
+    }
+    gfm_codec_destroy(codec);
+    delete pool;
+    return status;
+}
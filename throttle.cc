@@ -0,0 +1,135 @@
+#include "throttle.hh"
+
+#include <algorithm>
+#include <stdio.h>
+#include <unistd.h>
+
+Throttle throttle;
+
+// how often the adaptive write rate is reconsidered
+static const uint64_t PERIOD_NS = 100000000;
+// and the least it'll back off to, bytes a second
+static const uint64_t MIN_RATE  = 256 << 10;
+
+void TokenBucket::SetRate(uint64_t rate_, uint64_t burst_)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    rate  = rate_;
+    burst = burst_ ? burst_ : std::max<double>(rate / 10, 64 << 10);
+    tokens = std::min(tokens, burst);
+    last   = now();
+}
+
+uint64_t TokenBucket::Rate() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return rate;
+}
+
+void TokenBucket::Take(uint64_t bytes)
+{
+    uint64_t wait = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!rate)
+        {
+            return;
+        }
+        uint64_t t = now();
+        tokens = std::min(burst, tokens + ((t - last) * rate / 1e9));
+        last   = t;
+        tokens -= bytes;
+        if (tokens < 0)
+        {
+            wait = -tokens * 1e9 / rate;
+        }
+    }
+    // the tokens are spoken for, so others can work out their wait
+    // in the meantime
+    if (wait)
+    {
+        usleep(wait / 1000);
+    }
+}
+
+Throttle::Throttle()
+    : enabled(false)
+    , shardRate(0)
+    , target(0)
+    , writeLimit(0)
+    , periodStart(0)
+    , periodBytes(0)
+    , periodWrites(0)
+    , periodNs(0)
+    , step(0)
+    , backoffs(0)
+    , lowest(0)
+{
+}
+
+void Throttle::SetShard(uint64_t rate)
+{
+    shardRate = rate;
+    for (unsigned idx = 0; idx < MAX_SHARDS; idx++)
+    {
+        shard[idx].SetRate(rate);
+    }
+    Update();
+}
+
+void Throttle::Adapt(uint64_t bytes, uint64_t ns)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    const uint64_t t = now();
+    if (!periodStart)
+    {
+        periodStart = t;
+    }
+    periodBytes += bytes;
+    periodWrites++;
+    periodNs    += ns;
+    if ((t - periodStart) < PERIOD_NS)
+    {
+        return;
+    }
+
+    uint64_t rate = write.Rate();
+    if ((periodNs / periodWrites) > target)
+    {
+        // half what it was, or was managing if it was unlimited
+        if (!rate)
+        {
+            rate = periodBytes * 1e9 / (t - periodStart);
+        }
+        rate = std::max(rate / 2, MIN_RATE);
+        step = std::max(rate / 16, MIN_RATE);
+        lowest = lowest ? std::min(lowest, rate) : rate;
+        backoffs++;
+        write.SetRate(rate);
+    }
+    else if (rate && (!writeLimit || (rate < writeLimit)))
+    {
+        rate += step;
+        write.SetRate(writeLimit ? std::min(rate, writeLimit) : rate);
+    }
+    periodStart = t;
+    periodBytes  = 0;
+    periodWrites = 0;
+    periodNs     = 0;
+}
+
+void Throttle::Report() const
+{
+    if (!target)
+    {
+        return;
+    }
+    fprintf(stderr, "write latency over %g ms: backed off %u times",
+            target / 1e6, backoffs);
+    if (backoffs)
+    {
+        fprintf(stderr, ", to as little as %.1f MB/s, ending at %.1f MB/s",
+                lowest / 1e6, write.Rate() / 1e6);
+    }
+    fprintf(stderr, "\n");
+}
@@ -0,0 +1,137 @@
+#ifndef THROTTLE_HH
+#define THROTTLE_HH
+
+#include "timer.hh"
+
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+
+// 'rate' bytes a second, on average. Take() returns once what's
+// taken has been paid for, having waited if need be. Up to 'burst'
+// bytes go straight through after a lull.
+class TokenBucket
+{
+public:
+    TokenBucket()
+        : rate(0)
+        , burst(0)
+        , tokens(0)
+        , last(0)
+        {
+        }
+
+    // 0 for no limit. 'burst' defaults to 1/10th of a second's worth.
+    void SetRate(uint64_t rate, uint64_t burst = 0);
+    uint64_t Rate() const;
+
+    // wait for 'bytes' worth. Called after the I/O it's for, so the
+    // next one waits instead if there wasn't enough.
+    void Take(uint64_t bytes);
+
+private:
+    mutable std::mutex mutex;
+    double   rate;
+    double   burst;
+    // may go negative, it's paid back before anyone else goes
+    double   tokens;
+    uint64_t last;
+};
+
+/*
+  --read-limit, --write-limit, --shard-limit and --write-latency: keep
+  gfm from swamping the disks (and whoever else is on them). Reads
+  (input or shards) and writes (shards or output) have a bucket each,
+  and every shard one of its own for both.
+
+  With a write latency target the write rate adapts to how long the
+  writes take, AIMD style: halved after a period in which they took
+  longer than that on average, up a step after one in which they
+  didn't, never over
+  --write-limit. With no --write-limit it starts out unlimited and
+  the first back off is to half the rate writes were going at.
+
+  When none of them is set every call is a single test.
+*/
+class Throttle
+{
+public:
+    static const unsigned MAX_SHARDS = 256;
+
+    Throttle();
+
+    void SetRead(uint64_t rate)
+        {
+            read.SetRate(rate);
+            Update();
+        }
+    void SetWrite(uint64_t rate)
+        {
+            write.SetRate(rate);
+            writeLimit = rate;
+            Update();
+        }
+    void SetShard(uint64_t rate);
+    void SetLatency(uint64_t ns)
+        {
+            target = ns;
+            Update();
+        }
+
+    // start timing a write
+    inline uint64_t start() const
+        {
+            return enabled ? now() : 0;
+        }
+
+    // 'bytes' read (from shard 'idx', if not -1)
+    inline void Read(uint64_t bytes, int idx = -1)
+        {
+            if (!enabled) return;
+            read.Take(bytes);
+            if (idx >= 0) shard[idx].Take(bytes);
+        }
+
+    // 'bytes' written (to shard 'idx', if not -1), since start() 't0'
+    inline void Write(uint64_t bytes, uint64_t t0, int idx = -1)
+        {
+            if (!enabled) return;
+            if (target) Adapt(bytes, now() - t0);
+            write.Take(bytes);
+            if (idx >= 0) shard[idx].Take(bytes);
+        }
+
+    // for --stats, how the write rate adapted
+    void Report() const;
+
+private:
+    void Update()
+        {
+            enabled = read.Rate() || write.Rate() || shardRate || target;
+        }
+    void Adapt(uint64_t bytes, uint64_t ns);
+
+    bool        enabled;
+    TokenBucket read;
+    TokenBucket write;
+    uint64_t    shardRate;
+    TokenBucket shard[MAX_SHARDS];
+
+    // the adaptive write rate
+    std::mutex  mutex;
+    uint64_t    target;
+    uint64_t    writeLimit;
+    // this period: when it began, bytes and writes, time writing
+    uint64_t    periodStart;
+    uint64_t    periodBytes;
+    uint64_t    periodWrites;
+    uint64_t    periodNs;
+    // added every calm period, set when backing off
+    uint64_t    step;
+    unsigned    backoffs;
+    uint64_t    lowest;
+};
+
+extern Throttle throttle;
+
+#endif // THROTTLE_HH
@@ -0,0 +1,251 @@
+#include "verify.hh"
+#include "stats.hh"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+struct Verifier::Job
+{
+    uint8_t ** buff;
+    std::vector<uint8_t> read;
+    size_t     len;
+    unsigned   shift;
+    // threads still to get to it
+    std::atomic<unsigned> refs;
+};
+
+// as md5sum prints it
+static std::string hexDigest(EVP_MD_CTX * ctx)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int  digestLen = sizeof(digest);
+    EVP_DigestFinal_ex(ctx, digest, &digestLen);
+
+    std::string hex;
+    for (unsigned i = 0; i < digestLen; i++)
+    {
+        char buff[3];
+        snprintf(buff, sizeof(buff), "%02x", digest[i]);
+        hex += buff;
+    }
+    return hex;
+}
+
+Verifier::Verifier(const std::string & md5File_,
+                   const std::vector<std::string> & names_,
+                   size_t blockSize_)
+    : md5File(md5File_)
+    , blockSize(blockSize_)
+    , names(names_)
+    , numWorkers(0)
+    , stream(EVP_MD_CTX_new())
+    , checkStream(false)
+{
+    EVP_DigestInit_ex(stream, EVP_md5(), 0);
+
+    // "DIGEST  NAME" per line, as md5sum writes (and checks) them
+    FILE * file = fopen(md5File.c_str(), "r");
+    if (!file)
+    {
+        return;
+    }
+    char line[4096];
+    while (fgets(line, sizeof(line), file))
+    {
+        char digest[129];
+        char name[4096];
+        if (sscanf(line, "%128[0-9a-f]  %4095[^\n]", digest, name) == 2)
+        {
+            expected[name] = digest;
+        }
+    }
+    fclose(file);
+}
+
+Verifier::~Verifier()
+{
+    Drain();
+    for (size_t idx = 0; idx < shards.size(); idx++)
+    {
+        if (shards[idx].ctx) EVP_MD_CTX_free(shards[idx].ctx);
+        if (shards[idx].fd > 0) close(shards[idx].fd);
+    }
+    EVP_MD_CTX_free(stream);
+}
+
+void Verifier::Start(const int * fds, const off_t * start,
+                     std::function<void (uint8_t **)> release_)
+{
+    release = release_;
+
+    unsigned numShards = 0;
+    shards.resize(names.size());
+    for (size_t idx = 0; idx < names.size(); idx++)
+    {
+        Shard & s = shards[idx];
+        s.ctx   = 0;
+        s.whole = false;
+        s.fd    = 0;
+        s.start = 0;
+        if (!fds[idx] || !expected.count(names[idx])) continue;
+        s.fd = dup(fds[idx]);
+        if (s.fd < 0) continue;
+        s.ctx   = EVP_MD_CTX_new();
+        s.whole = s.ctx;
+        s.start = start[idx];
+        EVP_DigestInit_ex(s.ctx, EVP_md5(), 0);
+        numShards++;
+    }
+
+    numWorkers = std::max(1u, std::thread::hardware_concurrency());
+    numWorkers = std::max(1u, std::min(numWorkers, numShards));
+    // unless something else has it
+    const bool wantStream = !checkStream;
+    checkStream = true;
+    // all the queues before any of the threads
+    for (unsigned q = 0; q < (numWorkers + wantStream); q++)
+    {
+        queues.push_back(std::unique_ptr<StageQueue<Job *> >(new StageQueue<Job *>));
+    }
+    for (unsigned w = 0; w < numWorkers; w++)
+    {
+        threads.push_back(std::thread(&Verifier::Worker, this, w));
+    }
+    if (wantStream)
+    {
+        threads.push_back(std::thread(&Verifier::Stream, this));
+    }
+}
+
+void Verifier::Push(uint8_t ** buff, const uint8_t * read, size_t len,
+                    unsigned shift)
+{
+    Job * job = new Job;
+    job->buff  = buff;
+    job->read.assign(read, read + shards.size());
+    job->len   = len;
+    job->shift = shift;
+    job->refs = queues.size();
+    for (size_t q = 0; q < queues.size(); q++)
+    {
+        queues[q]->Push(job);
+    }
+}
+
+void Verifier::Drain()
+{
+    for (size_t q = 0; q < queues.size(); q++)
+    {
+        queues[q]->Push(0);
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+    {
+        threads[t].join();
+    }
+    queues.clear();
+    threads.clear();
+}
+
+// the last one out releases it
+void Verifier::Done(Job * job)
+{
+    if (!--job->refs)
+    {
+        release(job->buff);
+        delete job;
+    }
+}
+
+// every numWorkers'th shard, starting with w
+void Verifier::Worker(unsigned w)
+{
+    StageQueue<Job *> & queue = *queues[w];
+
+    // the headers (and tarballs) first
+    std::vector<uint8_t> buff(blockSize);
+    for (size_t idx = w; idx < shards.size(); idx += numWorkers)
+    {
+        Shard & s = shards[idx];
+        for (off_t off = 0; s.whole && (off < s.start); )
+        {
+            size_t len = std::min<off_t>(blockSize, s.start - off);
+            ssize_t got = pread(s.fd, buff.data(), len, off);
+            s.whole = (got == (ssize_t)len);
+            if (s.whole) EVP_DigestUpdate(s.ctx, buff.data(), len);
+            off += len;
+        }
+    }
+
+    for (Job * job = queue.Pop(); job; job = queue.Pop())
+    {
+        uint64_t t = stats.start();
+        uint64_t bytes = 0;
+        for (size_t idx = w; idx < shards.size(); idx += numWorkers)
+        {
+            Shard & s = shards[idx];
+            if (!s.whole) continue;
+            const size_t row = (idx + job->shift) % shards.size();
+            // a block it didn't read, so it can't be checked
+            s.whole = job->read[row];
+            if (!s.whole) continue;
+            EVP_DigestUpdate(s.ctx, job->buff[row], blockSize);
+            bytes += blockSize;
+        }
+        stats.stop(Stats::DIGEST, t, bytes);
+        Done(job);
+    }
+}
+
+void Verifier::Stream()
+{
+    StageQueue<Job *> & queue = *queues.back();
+    for (Job * job = queue.Pop(); job; job = queue.Pop())
+    {
+        uint64_t t = stats.start();
+        EVP_DigestUpdate(stream, job->buff[0], job->len);
+        stats.stop(Stats::DIGEST, t, job->len);
+        Done(job);
+    }
+}
+
+bool Verifier::Report()
+{
+    Drain();
+
+    unsigned numChecked = 0, numFailed = 0, numListed = 0;
+    for (size_t idx = 0; idx < names.size(); idx++)
+    {
+        if (!expected.count(names[idx])) continue;
+        numListed++;
+        if ((idx >= shards.size()) || !shards[idx].whole) continue;
+        Shard & s = shards[idx];
+        numChecked++;
+        if (hexDigest(s.ctx) != expected[names[idx]])
+        {
+            fprintf(stderr, "%s: FAILED\n", names[idx].c_str());
+            numFailed++;
+        }
+    }
+    bool streamOk = true;
+    if (checkStream && expected.count("-"))
+    {
+        streamOk = (hexDigest(stream) == expected["-"]);
+        if (!streamOk)
+        {
+            fprintf(stderr, "-: FAILED\n");
+        }
+    }
+
+    fprintf(stderr, "Verified %s%u of %u shards against %s: ",
+            (checkStream && expected.count("-")) ? "the output and " : "",
+            numChecked, numListed, md5File.c_str());
+    if (numFailed || !streamOk)
+    {
+        fprintf(stderr, "%u FAILED\n", numFailed + !streamOk);
+        return false;
+    }
+    fprintf(stderr, "OK\n");
+    return true;
+}
@@ -0,0 +1,106 @@
+#ifndef VERIFY_HH
+#define VERIFY_HH
+
+#include "pool.hh"
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <openssl/evp.h>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <vector>
+
+/*
+  --verify: check what's recovered against STUB.md5 on the way
+  through, rather than with '| tee | md5sum --check' afterwards.
+  The output stream is digested on a thread of its own and the shards
+  a few to a thread, straight from the stripe buffers once they've
+  been written and before they go back to the pool.
+
+  A shard can only be checked if all of it was read. Spares, shards
+  that came up short and those --hedge didn't wait for are left out
+  (and counted as such).
+*/
+class Verifier
+{
+public:
+    // the digests listed in 'md5File' for shards 'names' (as named
+    // there), of 'blockSize' byte blocks
+    Verifier(const std::string & md5File,
+             const std::vector<std::string> & names,
+             size_t blockSize);
+    // Drain()s
+    ~Verifier();
+
+    // read 'md5File'?
+    bool good() const
+        {
+            return !expected.empty();
+        }
+
+    // start the threads. Each shard's header (up to 'start') is read
+    // from a dup() of 'fds', 0 for the missing ones. The output is
+    // digested too, unless streamDigest() was called first. 'release'
+    // gets each stripe back once everyone's done with it.
+    void Start(const int * fds, const off_t * start,
+               std::function<void (uint8_t **)> release);
+
+    // a stripe as written: 'read' is non-zero for every row in it as
+    // read (not rebuilt), and 'len' bytes of buff[0] were output.
+    // Shard N has row (N + 'shift') of them (--rotate).
+    void Push(uint8_t ** buff, const uint8_t * read, size_t len,
+              unsigned shift = 0);
+
+    // wait for every stripe pushed to be digested (and released)
+    void Drain();
+
+    // for whatever digests the output instead (zstd, decompressing),
+    // before Start()
+    EVP_MD_CTX * streamDigest()
+        {
+            checkStream = true;
+            return stream;
+        }
+
+    // compare, print any mismatches and a summary on stderr.
+    // false if anything didn't match.
+    bool Report();
+
+private:
+    Verifier(const Verifier &);
+    Verifier & operator=(const Verifier &);
+
+    struct Job;
+    struct Shard
+    {
+        EVP_MD_CTX * ctx;
+        // every block so far has gone into ctx
+        bool         whole;
+        int          fd;
+        off_t        start;
+    };
+
+    void Worker(unsigned w);
+    void Stream();
+    void Done(Job * job);
+
+    std::string md5File;
+    size_t      blockSize;
+    // from md5File, by name
+    std::map<std::string, std::string> expected;
+    std::vector<std::string> names;
+    std::vector<Shard> shards;
+    unsigned     numWorkers;
+    EVP_MD_CTX * stream;
+    // the output was digested, one way or the other
+    bool         checkStream;
+    std::function<void (uint8_t **)> release;
+    // one per worker (and the stream last)
+    std::vector<std::unique_ptr<StageQueue<Job *> > > queues;
+    std::vector<std::thread> threads;
+};
+
+#endif // VERIFY_HH
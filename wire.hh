@@ -0,0 +1,46 @@
+#ifndef WIRE_HH
+#define WIRE_HH
+
+#include <stdint.h>
+
+/*
+  The multi-byte fields of what gfm writes to disk or tape (shard
+  headers, --stream records) are little-endian at fixed offsets,
+  whatever the byte order and struct layout of the machine, so they
+  read back anywhere.
+*/
+
+inline void putLE16(uint8_t * p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+inline void putLE32(uint8_t * p, uint32_t v)
+{
+    putLE16(p, v);
+    putLE16(p + 2, v >> 16);
+}
+
+inline void putLE64(uint8_t * p, uint64_t v)
+{
+    putLE32(p, v);
+    putLE32(p + 4, v >> 32);
+}
+
+inline uint16_t getLE16(const uint8_t * p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+inline uint32_t getLE32(const uint8_t * p)
+{
+    return getLE16(p) | ((uint32_t)getLE16(p + 2) << 16);
+}
+
+inline uint64_t getLE64(const uint8_t * p)
+{
+    return getLE32(p) | ((uint64_t)getLE32(p + 4) << 32);
+}
+
+#endif // WIRE_HH
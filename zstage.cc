@@ -0,0 +1,232 @@
+#include "zstage.hh"
+#include "stats.hh"
+#include "throttle.hh"
+
+#include <future>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef GFM_ZSTD
+#include <zstd.h>
+#endif
+
+void attest(bool test, const char * epilogue, ...);
+ssize_t readFully(int fd, void * buff, ssize_t len, bool isPipe = false);
+
+struct ZStage::Chunk
+{
+    std::vector<char>  src;
+    std::vector<char>  dst;
+    std::promise<void> done;
+};
+
+static unsigned workersFor(unsigned threads)
+{
+    if (!threads)
+    {
+        threads = std::thread::hardware_concurrency();
+    }
+    return threads ? threads : 1;
+}
+
+ZStage::ZStage(bool compress_, int in_, int out_, int level_,
+               unsigned threads_, EVP_MD_CTX * digest_)
+    : compress(compress_)
+    , in(in_)
+    , out(out_)
+    , level(level_)
+    , digest(digest_)
+    , numWorkers(workersFor(threads_))
+    , inFlight(2 * numWorkers)
+{
+    attest(available(), "gfm was built without zstd (libzstd-dev)");
+
+    threads.push_back(std::thread(&ZStage::Reader, this));
+    for (unsigned w = 0; w < numWorkers; w++)
+    {
+        threads.push_back(std::thread(&ZStage::Worker, this));
+    }
+    threads.push_back(std::thread(&ZStage::Writer, this));
+}
+
+ZStage::~ZStage()
+{
+    Join();
+}
+
+void ZStage::Join()
+{
+    for (size_t idx = 0; idx < threads.size(); idx++)
+    {
+        threads[idx].join();
+    }
+    threads.clear();
+}
+
+bool ZStage::available()
+{
+#ifdef GFM_ZSTD
+    return true;
+#else
+    return false;
+#endif
+}
+
+#ifdef GFM_ZSTD
+
+// cut the input into chunks (or frames) for the workers
+void ZStage::Reader()
+{
+    // bytes of compressed stream read but not handed out yet
+    std::vector<char> pending;
+    bool eof = false;
+
+    while (!eof)
+    {
+        if (compress)
+        {
+            Chunk * c = new Chunk;
+            c->src.resize(ZSTAGE_CHUNK);
+            ssize_t n = readFully(in, c->src.data(), ZSTAGE_CHUNK);
+            attest(n >= 0, "Unable to read input: %m");
+            throttle.Read(n);
+            c->src.resize(n);
+            eof = (n != (ssize_t)ZSTAGE_CHUNK);
+            if (!n)
+            {
+                delete c;
+                break;
+            }
+            if (digest)
+            {
+                uint64_t t = stats.start();
+                EVP_DigestUpdate(digest, c->src.data(), n);
+                stats.stop(Stats::DIGEST, t, n);
+            }
+            inFlight.Acquire();
+            order.Push(c);
+            work.Push(c);
+            continue;
+        }
+
+        size_t old = pending.size();
+        pending.resize(old + ZSTAGE_CHUNK);
+        // from recovery's pipe
+        ssize_t n = readFully(in, pending.data() + old, ZSTAGE_CHUNK, true);
+        attest(n >= 0, "Unable to read zstd stream: %m");
+        pending.resize(old + n);
+        eof = (n != (ssize_t)ZSTAGE_CHUNK);
+
+        // hand out every whole frame there is
+        size_t used = 0;
+        while (used < pending.size())
+        {
+            size_t len = ZSTD_findFrameCompressedSize(pending.data() + used,
+                                                      pending.size() - used);
+            if (ZSTD_isError(len))
+            {
+                break;
+            }
+            Chunk * c = new Chunk;
+            c->src.assign(pending.begin() + used, pending.begin() + used + len);
+            used += len;
+            inFlight.Acquire();
+            order.Push(c);
+            work.Push(c);
+        }
+        pending.erase(pending.begin(), pending.begin() + used);
+        attest(pending.size() <= (ZSTD_compressBound(ZSTAGE_CHUNK) + ZSTAGE_CHUNK),
+               "zstd frame too big, or not zstd");
+    }
+    attest(pending.empty(), "zstd stream cut short, or not zstd");
+
+    for (unsigned w = 0; w < numWorkers; w++)
+    {
+        work.Push(0);
+    }
+    order.Push(0);
+}
+
+void ZStage::Worker()
+{
+    ZSTD_CCtx * cctx = compress ? ZSTD_createCCtx() : 0;
+    ZSTD_DCtx * dctx = compress ? 0 : ZSTD_createDCtx();
+    attest(cctx || dctx, "Unable to create zstd context");
+
+    for (Chunk * c = work.Pop(); c; c = work.Pop())
+    {
+        uint64_t t = stats.start();
+        if (compress)
+        {
+            c->dst.resize(ZSTD_compressBound(c->src.size()));
+            size_t len = ZSTD_compressCCtx(cctx,
+                                           c->dst.data(), c->dst.size(),
+                                           c->src.data(), c->src.size(),
+                                           level);
+            attest(!ZSTD_isError(len), "zstd: %s", ZSTD_getErrorName(len));
+            c->dst.resize(len);
+        }
+        else
+        {
+            // ZSTD_compressCCtx() always records the size
+            unsigned long long len =
+                ZSTD_getFrameContentSize(c->src.data(), c->src.size());
+            attest((len != ZSTD_CONTENTSIZE_UNKNOWN) &&
+                   (len != ZSTD_CONTENTSIZE_ERROR),
+                   "zstd frame without a content size");
+            // no chunk is ever bigger, so no frame that says it is
+            // gets to size the buffer
+            attest(len <= ZSTAGE_CHUNK,
+                   "zstd frame of %llu bytes, at most %zu expected",
+                   len, ZSTAGE_CHUNK);
+            c->dst.resize(len);
+            size_t got = ZSTD_decompressDCtx(dctx,
+                                             c->dst.data(), c->dst.size(),
+                                             c->src.data(), c->src.size());
+            attest(!ZSTD_isError(got) && (got == len),
+                   "zstd: %s", ZSTD_isError(got)
+                   ? ZSTD_getErrorName(got)
+                   : "frame size mismatch");
+        }
+        stats.stop(Stats::ZSTD, t, compress ? c->src.size() : c->dst.size());
+        c->done.set_value();
+    }
+
+    ZSTD_freeCCtx(cctx);
+    ZSTD_freeDCtx(dctx);
+}
+
+#else
+
+void ZStage::Reader()
+{
+}
+
+void ZStage::Worker()
+{
+}
+
+#endif // GFM_ZSTD
+
+// write the chunks out in the order they were read
+void ZStage::Writer()
+{
+    for (Chunk * c = order.Pop(); c; c = order.Pop())
+    {
+        c->done.get_future().wait();
+        if (digest && !compress)
+        {
+            EVP_DigestUpdate(digest, c->dst.data(), c->dst.size());
+        }
+        for (size_t done = 0; done < c->dst.size(); )
+        {
+            ssize_t n = write(out, c->dst.data() + done, c->dst.size() - done);
+            attest(n > 0, "Unable to write %s stream: %m",
+                   compress ? "compressed" : "decompressed");
+            done += n;
+        }
+        delete c;
+        inFlight.Release();
+    }
+    close(out);
+}
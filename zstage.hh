@@ -0,0 +1,73 @@
+#ifndef ZSTAGE_HH
+#define ZSTAGE_HH
+
+#include "pool.hh"
+
+#include <openssl/evp.h>
+#include <thread>
+#include <vector>
+
+/*
+  zstd (de)compression on a pool of threads, from one file descriptor
+  to another, for --zstd. The stream is cut into ZSTAGE_CHUNK pieces,
+  each compressed as a frame of its own so they can all be done at
+  once, and written out in order. The result is a plain zstd stream,
+  'zstd -d' decompresses it too.
+
+  Decompression finds the frames and hands them out the same way, so
+  it only goes wide on streams made like that.
+
+  It's only there if the Makefile found libzstd (libzstd-dev) and
+  defined GFM_ZSTD, otherwise ZStage::available() says there's none.
+*/
+
+/// uncompressed bytes per frame
+const size_t ZSTAGE_CHUNK = 4 << 20;
+
+/// the 'compression' of shards, STUB.shards and --stream headers
+const uint8_t SHARD_PLAIN = 0;
+const uint8_t SHARD_ZSTD  = 1;
+
+class ZStage
+{
+public:
+    // read 'in' until EOF (and close it), (de)compress onto 'out'
+    // (closed at the end) with 'threads' workers, 0 for one per CPU.
+    // 'level' is the zstd compression level. If 'digest' isn't 0
+    // the uncompressed data goes through it too.
+    ZStage(bool compress, int in, int out, int level,
+           unsigned threads, EVP_MD_CTX * digest = 0);
+    // Join()s
+    ~ZStage();
+
+    // wait for it all to be written
+    void Join();
+
+    // built with zstd?
+    static bool available();
+
+private:
+    ZStage(const ZStage &);
+    ZStage & operator=(const ZStage &);
+
+    struct Chunk;
+
+    void Reader();
+    void Worker();
+    void Writer();
+
+    bool          compress;
+    int           in;
+    int           out;
+    int           level;
+    EVP_MD_CTX  * digest;
+    unsigned      numWorkers;
+    // chunks for the workers, and the same ones in order for the writer
+    StageQueue<Chunk *> work;
+    StageQueue<Chunk *> order;
+    // bounds the chunks in flight
+    Semaphore     inFlight;
+    std::vector<std::thread> threads;
+};
+
+#endif // ZSTAGE_HH